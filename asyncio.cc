@@ -0,0 +1,347 @@
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+
+#include "asyncio.h"
+
+
+// Threads in the fallback pool
+#define ASYNCIO_THREADS 4
+
+
+AsyncIO *AsyncIO::Create(const SIZE_T depth, const bool allowuring)
+{
+  if (allowuring) {
+    UringIO *u=new UringIO(depth);
+    if (u->Ok()) {
+      return u;
+    }
+    // no io_uring here (an old kernel, or a sandbox that blocks it)
+    delete u;
+  }
+
+  ThreadPoolIO *t=new ThreadPoolIO(depth,ASYNCIO_THREADS);
+  if (t->Ok()) {
+    return t;
+  }
+  delete t;
+  return 0;
+}
+
+
+//
+// io_uring
+//
+// The submission ring holds indexes into the array of entries, which
+// we keep in step: entry i always sits at ring slot i.  We own the
+// submission tail and the completion head; the kernel owns the
+// others, hence the acquire and release on each side.
+//
+
+static int uring_setup(const unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int uring_enter(const int fd, const unsigned tosubmit,
+		       const unsigned minwait, const unsigned flags)
+{
+  return syscall(__NR_io_uring_enter,fd,tosubmit,minwait,flags,0,0);
+}
+
+UringIO::UringIO(const SIZE_T depth) :
+  AsyncIO(depth), ringfd(-1), sqring(MAP_FAILED), cqring(MAP_FAILED),
+  sqringsize(0), cqringsize(0), sqes(MAP_FAILED), sqessize(0)
+{
+  struct io_uring_params p;
+  int fd;
+
+  memset(&p,0,sizeof(p));
+  if ((fd=uring_setup(depth,&p))<0) {
+    return;
+  }
+
+  sqringsize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  cqringsize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqringsize>sqringsize) {
+      sqringsize=cqringsize;
+    }
+    cqringsize=sqringsize;
+  }
+
+  sqring=mmap(0,sqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+	      fd,IORING_OFF_SQ_RING);
+  if (sqring==MAP_FAILED) {
+    close(fd);
+    return;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqring=sqring;
+  } else {
+    cqring=mmap(0,cqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+		fd,IORING_OFF_CQ_RING);
+    if (cqring==MAP_FAILED) {
+      munmap(sqring,sqringsize);
+      sqring=MAP_FAILED;
+      close(fd);
+      return;
+    }
+  }
+  sqessize=p.sq_entries*sizeof(struct io_uring_sqe);
+  sqes=mmap(0,sqessize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+	    fd,IORING_OFF_SQES);
+  if (sqes==MAP_FAILED) {
+    if (cqring!=sqring) {
+      munmap(cqring,cqringsize);
+    }
+    munmap(sqring,sqringsize);
+    sqring=cqring=MAP_FAILED;
+    close(fd);
+    return;
+  }
+
+  sqhead=(unsigned *)((char *)sqring+p.sq_off.head);
+  sqtail=(unsigned *)((char *)sqring+p.sq_off.tail);
+  sqmask=(unsigned *)((char *)sqring+p.sq_off.ring_mask);
+  sqarray=(unsigned *)((char *)sqring+p.sq_off.array);
+  cqhead=(unsigned *)((char *)cqring+p.cq_off.head);
+  cqtail=(unsigned *)((char *)cqring+p.cq_off.tail);
+  cqmask=(unsigned *)((char *)cqring+p.cq_off.ring_mask);
+  cqes=(char *)cqring+p.cq_off.cqes;
+  sqentries=p.sq_entries;
+
+  // the completion ring is at least as big as the submission ring,
+  // so holding to this depth means it never overflows
+  if (this->depth>sqentries) {
+    this->depth=sqentries;
+  }
+  ringfd=fd;
+}
+
+UringIO::~UringIO()
+{
+  if (ringfd<0) {
+    return;
+  }
+  munmap(sqes,sqessize);
+  if (cqring!=sqring) {
+    munmap(cqring,cqringsize);
+  }
+  munmap(sqring,sqringsize);
+  close(ringfd);
+}
+
+// Submits entries and optionally waits for completions
+ERROR_T UringIO::Enter(const unsigned tosubmit, const unsigned minwait)
+{
+  unsigned left=tosubmit;
+  int      rc;
+
+  do {
+    rc=uring_enter(ringfd,left,minwait,minwait ? IORING_ENTER_GETEVENTS : 0);
+    if (rc<0) {
+      if (errno==EINTR || errno==EAGAIN) {
+	continue;
+      }
+      return ERROR_GENERAL;
+    }
+    left-=rc;
+  } while (left>0);
+
+  return ERROR_NOERROR;
+}
+
+// Moves whatever has completed to done
+void UringIO::Harvest(vector<AsyncIORequest *> &done)
+{
+  unsigned head=*cqhead;
+  unsigned tail=__atomic_load_n(cqtail,__ATOMIC_ACQUIRE);
+
+  while (head!=tail) {
+    struct io_uring_cqe *cqe=(struct io_uring_cqe *)cqes+(head & *cqmask);
+    AsyncIORequest *r=(AsyncIORequest *)(uintptr_t)cqe->user_data;
+    r->result=cqe->res;
+    done.push_back(r);
+    inflight--;
+    head++;
+  }
+  __atomic_store_n(cqhead,head,__ATOMIC_RELEASE);
+}
+
+ERROR_T UringIO::Submit(AsyncIORequest **reqs, const SIZE_T n)
+{
+  unsigned queued=0;
+
+  for (SIZE_T i=0;i<n;i++) {
+    // make room, keeping what completes for the next Reap
+    while (inflight>=depth) {
+      if (Enter(queued,1)) {
+	return ERROR_GENERAL;
+      }
+      queued=0;
+      Harvest(early);
+    }
+
+    AsyncIORequest *r=reqs[i];
+    unsigned tail=*sqtail;
+    unsigned idx=tail & *sqmask;
+    struct io_uring_sqe *sqe=(struct io_uring_sqe *)sqes+idx;
+
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode=r->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd=r->fd;
+    sqe->addr=(uintptr_t)r->buf;
+    sqe->len=r->len;
+    sqe->off=r->off;
+    sqe->user_data=(uintptr_t)r;
+    sqarray[idx]=idx;
+    __atomic_store_n(sqtail,tail+1,__ATOMIC_RELEASE);
+    queued++;
+    inflight++;
+  }
+
+  return queued>0 ? Enter(queued,0) : ERROR_NOERROR;
+}
+
+ERROR_T UringIO::Reap(vector<AsyncIORequest *> &done, const SIZE_T min)
+{
+  SIZE_T got=early.size();
+  SIZE_T want=min<got+inflight ? min : got+inflight;
+
+  done.insert(done.end(),early.begin(),early.end());
+  early.clear();
+
+  SIZE_T before=done.size();
+  Harvest(done);
+  got+=done.size()-before;
+
+  while (got<want) {
+    if (Enter(0,want-got)) {
+      return ERROR_GENERAL;
+    }
+    before=done.size();
+    Harvest(done);
+    got+=done.size()-before;
+  }
+  return ERROR_NOERROR;
+}
+
+
+//
+// Thread pool
+//
+
+ThreadPoolIO::ThreadPoolIO(const SIZE_T depth, const SIZE_T numthreads) :
+  AsyncIO(depth), stopping(false)
+{
+  pthread_mutex_init(&lock,0);
+  pthread_cond_init(&work,0);
+  pthread_cond_init(&finished,0);
+
+  for (SIZE_T i=0;i<numthreads;i++) {
+    pthread_t t;
+    if (pthread_create(&t,0,Worker,this)) {
+      break;
+    }
+    threads.push_back(t);
+  }
+}
+
+ThreadPoolIO::~ThreadPoolIO()
+{
+  pthread_mutex_lock(&lock);
+  stopping=true;
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+
+  for (SIZE_T i=0;i<threads.size();i++) {
+    pthread_join(threads[i],0);
+  }
+
+  pthread_cond_destroy(&finished);
+  pthread_cond_destroy(&work);
+  pthread_mutex_destroy(&lock);
+}
+
+void *ThreadPoolIO::Worker(void *pool)
+{
+  ((ThreadPoolIO *)pool)->Loop();
+  return 0;
+}
+
+void ThreadPoolIO::Loop()
+{
+  pthread_mutex_lock(&lock);
+
+  while (true) {
+    while (pending.empty() && !stopping) {
+      pthread_cond_wait(&work,&lock);
+    }
+    if (pending.empty()) {
+      break;
+    }
+    AsyncIORequest *r=pending.front();
+    pending.pop_front();
+    pthread_mutex_unlock(&lock);
+
+    SIZE_T  left=r->len;
+    ssize_t n=0;
+    while (left>0) {
+      SIZE_T at=r->len-left;
+      if (r->write) {
+	n=pwrite(r->fd,r->buf+at,left,r->off+at);
+      } else {
+	n=pread(r->fd,r->buf+at,left,r->off+at);
+      }
+      if (n<0 && errno==EINTR) {
+	continue;
+      }
+      if (n<=0) {
+	break;
+      }
+      left-=n;
+    }
+    r->result = (n<0 && left==r->len) ? -errno : (ssize_t)(r->len-left);
+
+    pthread_mutex_lock(&lock);
+    completed.push_back(r);
+    pthread_cond_broadcast(&finished);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+ERROR_T ThreadPoolIO::Submit(AsyncIORequest **reqs, const SIZE_T n)
+{
+  pthread_mutex_lock(&lock);
+  for (SIZE_T i=0;i<n;i++) {
+    while (inflight-completed.size()>=depth) {
+      pthread_cond_wait(&finished,&lock);
+    }
+    pending.push_back(reqs[i]);
+    inflight++;
+    pthread_cond_signal(&work);
+  }
+  pthread_mutex_unlock(&lock);
+  return ERROR_NOERROR;
+}
+
+ERROR_T ThreadPoolIO::Reap(vector<AsyncIORequest *> &done, const SIZE_T min)
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T want=min<inflight ? min : inflight;
+  while (completed.size()<want) {
+    pthread_cond_wait(&finished,&lock);
+  }
+  done.insert(done.end(),completed.begin(),completed.end());
+  inflight-=completed.size();
+  completed.clear();
+  pthread_mutex_unlock(&lock);
+  return ERROR_NOERROR;
+}
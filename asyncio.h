@@ -0,0 +1,122 @@
+#ifndef _asyncio
+#define _asyncio
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// One transfer for an AsyncIO engine: len bytes between buf and
+// offset off of fd.  The engine sets result when it completes.
+//
+struct AsyncIORequest {
+  int      fd;
+  bool     write;
+  BYTE_T  *buf;
+  SIZE_T   len;
+  SIZE_T   off;
+  ssize_t  result;   // bytes transferred, or -errno
+  void    *tag;      // the caller's
+};
+
+
+//
+// Submission and completion interface for real file I/O
+//
+// Submit hands the engine a batch of transfers and returns without
+// waiting for them; Reap collects finished ones, which may come back
+// in any order.  Up to the engine's depth can be in flight at once;
+// Submit waits for room when there is none.  The requests must stay
+// put until they are reaped.
+//
+// Create picks io_uring, driven by raw system calls, when the kernel
+// offers it, and otherwise a small pool of threads doing pread and
+// pwrite.
+//
+// Not thread safe; callers serialize.
+//
+class AsyncIO {
+ protected:
+  SIZE_T depth;
+  SIZE_T inflight;
+ public:
+  AsyncIO(const SIZE_T depth) : depth(depth), inflight(0) {}
+  virtual ~AsyncIO() {}
+
+  // returns ERROR_NOERROR or ERROR_GENERAL if the engine has failed
+  virtual ERROR_T Submit(AsyncIORequest **reqs, const SIZE_T n)=0;
+  // Waits until at least min transfers (no more than are in flight)
+  // have completed and appends every completed one to done
+  // returns ERROR_NOERROR or ERROR_GENERAL if the engine has failed
+  virtual ERROR_T Reap(vector<AsyncIORequest *> &done, const SIZE_T min)=0;
+  virtual const char *GetName() const=0;
+
+  SIZE_T GetDepth() const { return depth; }
+  SIZE_T GetNumInFlight() const { return inflight; }
+
+  // returns a new engine, or 0 if neither kind could be started
+  static AsyncIO *Create(const SIZE_T depth, const bool allowuring=true);
+};
+
+
+// io_uring, set up with io_uring_setup and its rings mapped by hand
+class UringIO : public AsyncIO {
+ private:
+  int       ringfd;
+  void     *sqring, *cqring;
+  size_t    sqringsize, cqringsize;
+  void     *sqes;
+  size_t    sqessize;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  void     *cqes;
+  unsigned  sqentries;
+  vector<AsyncIORequest *> early;  // reaped while Submit made room
+
+  ERROR_T Enter(const unsigned tosubmit, const unsigned minwait);
+  void    Harvest(vector<AsyncIORequest *> &done);
+ public:
+  UringIO(const SIZE_T depth);
+  virtual ~UringIO();
+
+  // true if the ring was set up
+  bool Ok() const { return ringfd>=0; }
+
+  ERROR_T Submit(AsyncIORequest **reqs, const SIZE_T n);
+  ERROR_T Reap(vector<AsyncIORequest *> &done, const SIZE_T min);
+  const char *GetName() const { return "io_uring"; }
+};
+
+
+// Worker threads blocking in pread and pwrite
+class ThreadPoolIO : public AsyncIO {
+ private:
+  vector<pthread_t>        threads;
+  pthread_mutex_t          lock;
+  pthread_cond_t           work;      // pending is non-empty or stopping
+  pthread_cond_t           finished;  // something was added to completed
+  deque<AsyncIORequest *>  pending;
+  vector<AsyncIORequest *> completed;
+  bool                     stopping;
+
+  static void *Worker(void *pool);
+  void Loop();
+ public:
+  ThreadPoolIO(const SIZE_T depth, const SIZE_T numthreads);
+  virtual ~ThreadPoolIO();
+
+  // true if at least one thread started
+  bool Ok() const { return !threads.empty(); }
+
+  ERROR_T Submit(AsyncIORequest **reqs, const SIZE_T n);
+  ERROR_T Reap(vector<AsyncIORequest *> &done, const SIZE_T min);
+  const char *GetName() const { return "threads"; }
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "bitmapalloc.h"
+
+
+#define WORD_BITS 64
+#define ALL_ONES  (~(uint64_t)0)
+
+// The bits of a word for its blocks a up to b, 0<=a<b<=64
+static inline uint64_t blockmask(const SIZE_T a, const SIZE_T b)
+{
+  uint64_t from = ALL_ONES>>a;
+  uint64_t to = b>=WORD_BITS ? 0 : ALL_ONES>>b;
+
+  return from & ~to;
+}
+
+
+BitMapAllocator::BitMapAllocator() :
+  bits(0), numblocks(0), numwords(0), numfree(0), counted(false), pagesize(WORD_BITS/8)
+{}
+
+void BitMapAllocator::Attach(BYTE_T *b, const SIZE_T n, const SIZE_T psize)
+{
+  SIZE_T numbytes=(n+7)/8;
+
+  bits=b;
+  numblocks=n;
+  numwords=(n+WORD_BITS-1)/WORD_BITS;
+  numfree=0;
+  counted=false;
+  summary.assign((numwords+WORD_BITS-1)/WORD_BITS,0);
+  summarized.assign(summary.size(),false);
+  // whole words to a page
+  pagesize = psize<WORD_BITS/8 ? WORD_BITS/8 : psize-psize%(WORD_BITS/8);
+  dirty.assign((numbytes+pagesize-1)/pagesize,false);
+  dirtypages.clear();
+}
+
+SIZE_T BitMapAllocator::GetNumFree() const
+{
+  if (!counted) {
+    numfree=0;
+    for (SIZE_T w=0;w<numwords;w++) {
+      numfree+=WORD_BITS-__builtin_popcountll(Load(w));
+    }
+    counted=true;
+  }
+  return numfree;
+}
+
+void BitMapAllocator::GetDirtyPages(vector<SIZE_T> &pages) const
+{
+  pages=dirtypages;
+  sort(pages.begin(),pages.end());
+}
+
+void BitMapAllocator::CleanPages()
+{
+  for (SIZE_T i=0;i<dirtypages.size();i++) {
+    dirty[dirtypages[i]]=false;
+  }
+  dirtypages.clear();
+}
+
+uint64_t BitMapAllocator::Load(const SIZE_T word) const
+{
+  SIZE_T   off=word*(WORD_BITS/8);
+  SIZE_T   bytes=(numblocks+7)/8-off;
+  uint64_t v=0;
+
+  if (bytes>=WORD_BITS/8) {
+    memcpy(&v,bits+off,sizeof(v));
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+    v=__builtin_bswap64(v);
+#endif
+  } else {
+    for (SIZE_T i=0;i<WORD_BITS/8;i++) {
+      v=(v<<8) | (i<bytes ? bits[off+i] : 0);
+    }
+  }
+  if (word==numwords-1 && numblocks%WORD_BITS) {
+    v|=ALL_ONES>>(numblocks%WORD_BITS);
+  }
+  return v;
+}
+
+void BitMapAllocator::Store(const SIZE_T word, const uint64_t v)
+{
+  SIZE_T   off=word*(WORD_BITS/8);
+  SIZE_T   bytes=(numblocks+7)/8-off;
+  SIZE_T   page=off/pagesize;
+  uint64_t out=v;
+
+  if (!dirty[page]) {
+    dirty[page]=true;
+    dirtypages.push_back(page);
+  }
+
+  // the bits past the last block stay clear in the file
+  if (word==numwords-1 && numblocks%WORD_BITS) {
+    out&=~(ALL_ONES>>(numblocks%WORD_BITS));
+  }
+  if (bytes>=WORD_BITS/8) {
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+    out=__builtin_bswap64(out);
+#endif
+    memcpy(bits+off,&out,sizeof(out));
+  } else {
+    for (SIZE_T i=0;i<bytes;i++) {
+      bits[off+i]=(BYTE_T)(out>>(WORD_BITS-8*(i+1)));
+    }
+  }
+}
+
+void BitMapAllocator::Summarize(const SIZE_T word, const uint64_t v)
+{
+  uint64_t bit=(uint64_t)1<<(WORD_BITS-1-word%WORD_BITS);
+
+  // one not yet worked out is left for SummaryWord
+  if (!summarized[word/WORD_BITS]) {
+    return;
+  }
+  if (v==ALL_ONES) {
+    summary[word/WORD_BITS]&=~bit;
+  } else {
+    summary[word/WORD_BITS]|=bit;
+  }
+}
+
+uint64_t BitMapAllocator::SummaryWord(const SIZE_T s)
+{
+  if (!summarized[s]) {
+    SIZE_T last = (s+1)*WORD_BITS<numwords ? (s+1)*WORD_BITS : numwords;
+    summary[s]=0;
+    summarized[s]=true;
+    for (SIZE_T w=s*WORD_BITS;w<last;w++) {
+      Summarize(w,Load(w));
+    }
+  }
+  return summary[s];
+}
+
+SIZE_T BitMapAllocator::NextWithFree(const SIZE_T word, const SIZE_T end)
+{
+  SIZE_T   s=word/WORD_BITS;
+  uint64_t v;
+
+  if (word>=end) {
+    return end;
+  }
+  v=SummaryWord(s) & (ALL_ONES>>(word%WORD_BITS));
+  while (v==0) {
+    if (++s>=summary.size() || s*WORD_BITS>=end) {
+      return end;
+    }
+    v=SummaryWord(s);
+  }
+  SIZE_T next=s*WORD_BITS+__builtin_clzll(v);
+  return next<end ? next : end;
+}
+
+bool BitMapAllocator::IsSet(const SIZE_T block) const
+{
+  return block<numblocks && ((bits[block/8]>>(7-block%8)) & 0x1);
+}
+
+SIZE_T BitMapAllocator::Set(const SIZE_T first, const SIZE_T num)
+{
+  SIZE_T already=0;
+  SIZE_T b=first;
+  SIZE_T end = first+num<numblocks ? first+num : numblocks;
+
+  while (b<end) {
+    SIZE_T   w=b/WORD_BITS;
+    SIZE_T   a=b%WORD_BITS;
+    SIZE_T   e=end-b<WORD_BITS-a ? a+(end-b) : WORD_BITS;
+    uint64_t mask=blockmask(a,e);
+    uint64_t v=Load(w);
+    uint64_t nv=v|mask;
+
+    already+=__builtin_popcountll(v&mask);
+    if (counted) {
+      numfree-=__builtin_popcountll(nv)-__builtin_popcountll(v);
+    }
+    if (nv!=v) {
+      Store(w,nv);
+      Summarize(w,nv);
+    }
+    b+=e-a;
+  }
+  return already;
+}
+
+SIZE_T BitMapAllocator::Clear(const SIZE_T first, const SIZE_T num)
+{
+  SIZE_T already=0;
+  SIZE_T b=first;
+  SIZE_T end = first+num<numblocks ? first+num : numblocks;
+
+  while (b<end) {
+    SIZE_T   w=b/WORD_BITS;
+    SIZE_T   a=b%WORD_BITS;
+    SIZE_T   e=end-b<WORD_BITS-a ? a+(end-b) : WORD_BITS;
+    uint64_t mask=blockmask(a,e);
+    uint64_t v=Load(w);
+    uint64_t nv=v&~mask;
+
+    already+=__builtin_popcountll(~v&mask);
+    if (counted) {
+      numfree+=__builtin_popcountll(v)-__builtin_popcountll(nv);
+    }
+    if (nv!=v) {
+      Store(w,nv);
+      Summarize(w,nv);
+    }
+    b+=e-a;
+  }
+  return already;
+}
+
+bool BitMapAllocator::FindIn(const SIZE_T num, const SIZE_T from, const SIZE_T to,
+			     SIZE_T &first)
+{
+  SIZE_T run=0;        // free blocks in a row up to w
+  SIZE_T runstart=0;
+  SIZE_T w=from/WORD_BITS;
+  SIZE_T endw=(to+WORD_BITS-1)/WORD_BITS;
+
+  while (w<endw) {
+    if (run==0) {
+      if ((w=NextWithFree(w,endw))>=endw) {
+	break;
+      }
+    }
+
+    // blocks outside from up to to count as allocated
+    uint64_t v=Load(w);
+    if (w==from/WORD_BITS) {
+      v|=~(ALL_ONES>>(from%WORD_BITS));
+    }
+    if (w==(to-1)/WORD_BITS && to%WORD_BITS) {
+      v|=ALL_ONES>>(to%WORD_BITS);
+    }
+
+    if (v==0) {
+      if (run==0) {
+	runstart=w*WORD_BITS;
+      }
+      run+=WORD_BITS;
+      if (run>=num) {
+	first=runstart;
+	return true;
+      }
+      w++;
+      continue;
+    }
+
+    // the run so far carries on through the word's leading free blocks
+    SIZE_T lead=__builtin_clzll(v);
+    if (run+lead>=num) {
+      first = run ? runstart : w*WORD_BITS;
+      return true;
+    }
+
+    // or a short one fits inside: keep the bits that start num free
+    // blocks in a row, doubling the stretch each step
+    if (num<=WORD_BITS) {
+      uint64_t m=~v;
+      SIZE_T   len=1;
+      while (len<num && m) {
+	SIZE_T s = len<num-len ? len : num-len;
+	m&=m<<s;
+	len+=s;
+      }
+      if (m) {
+	first=w*WORD_BITS+__builtin_clzll(m);
+	return true;
+      }
+    }
+
+    // and its trailing free blocks start the next
+    run=__builtin_ctzll(v);
+    runstart=(w+1)*WORD_BITS-run;
+    w++;
+  }
+  return false;
+}
+
+bool BitMapAllocator::Find(const SIZE_T num, const SIZE_T hint, SIZE_T &first)
+{
+  SIZE_T from = hint<numblocks ? hint : 0;
+
+  // (counting the free blocks just to fail sooner would read them all)
+  if (num==0 || num>numblocks || (counted && num>numfree)) {
+    return false;
+  }
+  if (FindIn(num,from,numblocks,first)) {
+    return true;
+  }
+  // then from the start, up to runs that would have reached past hint
+  SIZE_T to = from+num-1<numblocks ? from+num-1 : numblocks;
+  return from>0 && FindIn(num,0,to,first);
+}
@@ -0,0 +1,87 @@
+#ifndef _bitmapalloc
+#define _bitmapalloc
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Allocator over a disk's block bitmap
+//
+// The bitmap stays the disk's own: a bit per block, 1 if allocated,
+// the first block of each byte in its high bit.  The allocator reads
+// and changes it in place 64 blocks at a time, taking eight bytes
+// as a big endian word so the first block is the word's high bit and
+// a count of leading or trailing zeros finds the first or last free
+// block.  Over the words it keeps a summary, a bit for each word
+// with a free block in it, so a search steps over a full stretch of
+// 4096 blocks with one test, and it keeps count of the free blocks.
+//
+// Nothing is read until it is needed: a summary word is worked out
+// the first time a search reaches its stretch, and the free count
+// the first time it is asked for, so the pages of a bitmap mapped
+// from its file are only brought in as they are used.  The
+// allocator notes the pages, pagesize bytes long, that it changes,
+// for the disk to write back.
+//
+// Attach it again whenever the bitmap moves or is changed behind its
+// back, which forgets the summary and the changed pages.
+//
+// Not thread safe; callers serialize.
+//
+class BitMapAllocator {
+ private:
+  BYTE_T  *bits;
+  SIZE_T   numblocks;
+  SIZE_T   numwords;
+  mutable SIZE_T numfree;
+  mutable bool   counted;     // numfree is known
+  vector<uint64_t> summary;
+  vector<bool>     summarized; // per summary word
+  SIZE_T           pagesize;
+  vector<bool>     dirty;      // per page
+  vector<SIZE_T>   dirtypages;
+
+  // A word of the bitmap, with blocks past the end allocated
+  uint64_t Load(const SIZE_T word) const;
+  void     Store(const SIZE_T word, const uint64_t v);
+  void     Summarize(const SIZE_T word, const uint64_t v);
+  uint64_t SummaryWord(const SIZE_T s);
+  // The first word at or after word, and before end, with a free
+  // block, or end
+  SIZE_T   NextWithFree(const SIZE_T word, const SIZE_T end);
+  // Looks for num free blocks in a row, starting at or after from
+  // and ending before to
+  bool     FindIn(const SIZE_T num, const SIZE_T from, const SIZE_T to,
+		  SIZE_T &first);
+ public:
+  BitMapAllocator();
+
+  void   Attach(BYTE_T *bits, const SIZE_T numblocks, const SIZE_T pagesize);
+
+  // Blocks past the end, or with no bitmap attached, are not set
+  bool   IsSet(const SIZE_T block) const;
+  // Marks num blocks from first allocated, or free, ignoring any past
+  // the end
+  // returns how many of them already were
+  SIZE_T Set(const SIZE_T first, const SIZE_T num);
+  SIZE_T Clear(const SIZE_T first, const SIZE_T num);
+  // Finds num free blocks in a row, the first at or after hint if
+  // there are any such, otherwise the first anywhere, and leaves them
+  // free
+  // returns false if there is no such run
+  bool   Find(const SIZE_T num, const SIZE_T hint, SIZE_T &first);
+
+  SIZE_T GetNumFree() const;
+
+  // The pages changed since the last CleanPages, in order
+  void   GetDirtyPages(vector<SIZE_T> &pages) const;
+  void   CleanPages();
+  SIZE_T GetPageSize() const { return pagesize; }
+};
+
+#endif
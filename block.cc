@@ -1,20 +1,114 @@
 #include <new>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "block.h"
 
-Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false)
+
+//
+// The buffer pool.  Free buffers are chained through their first
+// bytes.  They are carved out of cache line aligned chunks, which
+// are never given back to the heap.
+//
+#define POOL_ALIGN    64
+#define POOL_MINCHUNK 16
+
+static pthread_mutex_t poollock=PTHREAD_MUTEX_INITIALIZER;
+static SIZE_T  poolsize=0;      // zero until ReservePool is called
+static SIZE_T  poolbuffers=0;   // buffers carved out so far
+static BYTE_T *poolfree=0;
+
+// Called with poollock held
+static ERROR_T GrowPool(const SIZE_T count)
+{
+  SIZE_T stride=(poolsize+POOL_ALIGN-1)/POOL_ALIGN*POOL_ALIGN;
+  void  *chunk;
+
+  if (posix_memalign(&chunk,POOL_ALIGN,stride*count)) { 
+    return ERROR_NOMEM;
+  }
+  for (SIZE_T i=count;i>0;i--) { 
+    BYTE_T *b=(BYTE_T *)chunk+(i-1)*stride;
+    memcpy(b,&poolfree,sizeof(poolfree));
+    poolfree=b;
+  }
+  poolbuffers+=count;
+  return ERROR_NOERROR;
+}
+
+ERROR_T Block::ReservePool(const SIZE_T size, const SIZE_T count)
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  if (size<sizeof(BYTE_T *)) { 
+    return ERROR_SIZE;
+  }
+  pthread_mutex_lock(&poollock);
+  if (poolsize==0) { 
+    poolsize=size;
+  }
+  if (poolsize!=size) { 
+    rc=ERROR_SIZE;
+  } else if (poolbuffers<count) { 
+    rc=GrowPool(count-poolbuffers);
+  }
+  pthread_mutex_unlock(&poollock);
+  return rc;
+}
+
+BYTE_T *Block::GetBuffer(const SIZE_T size)
+{
+  pthread_mutex_lock(&poollock);
+  if (size>0 && size==poolsize) { 
+    BYTE_T *b=0;
+    // double the pool when it runs dry
+    if (poolfree || GrowPool(poolbuffers>POOL_MINCHUNK ? poolbuffers : POOL_MINCHUNK)==ERROR_NOERROR) { 
+      b=poolfree;
+      memcpy(&poolfree,b,sizeof(poolfree));
+    }
+    pthread_mutex_unlock(&poollock);
+    return b;
+  }
+  pthread_mutex_unlock(&poollock);
+
+  try {
+    return new BYTE_T [size];
+  }
+  catch (...) {
+    return 0;
+  }
+}
+
+void Block::PutBuffer(BYTE_T *buf, const SIZE_T size)
+{
+  if (!buf) { 
+    return;
+  }
+  pthread_mutex_lock(&poollock);
+  if (size>0 && size==poolsize) { 
+    memcpy(buf,&poolfree,sizeof(poolfree));
+    poolfree=buf;
+    pthread_mutex_unlock(&poollock);
+    return;
+  }
+  pthread_mutex_unlock(&poollock);
+  delete [] buf;
+}
+
+
+Block::Block() : data(0), length(0), lastaccessed(-1), dirty(false), external(false)
 {}
 
 
-Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(const SIZE_T s) : data(0), length(0), lastaccessed(-1), dirty(false), external(false)
 {
   Resize(s);
 }
 
 
 
-Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty)
+Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccessed), dirty(rhs.dirty), external(false)
 {
   if (Resize(rhs.length)!=ERROR_NOERROR) { 
     throw GenericException();
@@ -22,7 +116,7 @@ Block::Block(const Block &rhs) : data(0), length(0), lastaccessed(rhs.lastaccess
   memcpy(data,rhs.data,rhs.length);
 }
 
-Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false)
+Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(false), external(false)
 {
   if (Resize(strlen(str))!=ERROR_NOERROR) { 
     throw GenericException();
@@ -32,7 +126,8 @@ Block::Block(const char * str) : data(0), length(0), lastaccessed(-1), dirty(fal
 
 Block::~Block() 
 { 
-  if (data) { delete [] data; data=0; }
+  if (data && !external) { PutBuffer(data,length); }
+  data=0;
   length=0;
   lastaccessed=-1;
   dirty=false;
@@ -40,7 +135,16 @@ Block::~Block()
 
 Block & Block::operator=(const Block &rhs)
 {
-  return *(new (this) Block(rhs));
+  if (this!=&rhs) { 
+    // keeps our buffer if it is already the right size
+    if (Resize(rhs.length,false)!=ERROR_NOERROR) { 
+      throw GenericException();
+    }
+    memcpy(data,rhs.data,rhs.length);
+    lastaccessed=rhs.lastaccessed;
+    dirty=rhs.dirty;
+  }
+  return *this;
 }
 
 
@@ -50,20 +154,23 @@ Block & Block::operator=(const Block &rhs)
 ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
 {
   BYTE_T *d;
-  
-  try {
-    d = new BYTE_T [newlen];
+
+  if (data && newlen==length) { 
+    return ERROR_NOERROR;
   }
-  catch (...) {
+  
+  d = GetBuffer(newlen);
+  if (!d) { 
     return ERROR_NOMEM;
   }
 
-  if (copy) { 
+  if (copy && data) { 
     memcpy(d,data,MIN(newlen,length));
   }
   
-  if (data) { delete [] data; }
+  if (data && !external) { PutBuffer(data,length); }
   data = d;
+  external = false;
 
   length=newlen;
 
@@ -71,6 +178,15 @@ ERROR_T Block::Resize(const SIZE_T newlen, const bool copy)
 }
 
 
+void Block::UseBuffer(BYTE_T *buf, const SIZE_T len)
+{
+  if (data && !external) { PutBuffer(data,length); }
+  data=buf;
+  length=len;
+  external=true;
+}
+
+
 static char high2hex(BYTE_T x)
 {
   x>>=4;
@@ -7,11 +7,22 @@
 
 using namespace std;
 
+//
+// A block of bytes
+//
+// Blocks normally own their data.  Buffers of the pool size (see
+// ReservePool) come from a shared pool of preallocated buffers and
+// go back to it when released, so once the pool is warm, making and
+// copying such blocks does not touch the heap.  A block can instead
+// be pointed at memory it doesn't own (UseBuffer), such as a frame
+// of a cache's arena; it never frees that memory.
+//
 struct Block {
   BYTE_T	*data;
   SIZE_T 	length;
   double        lastaccessed;  // for use in buffercache only
   bool          dirty;         // for use in buffercahce only
+  bool          external;      // data is not ours to free
 
   Block();
   Block(const SIZE_T size);
@@ -24,6 +35,22 @@ struct Block {
   // ERROR_NOMEM or other nonzero error code.
   ERROR_T Resize(const SIZE_T newlength, const bool copy=true);
 
+  // Makes the block a view of len bytes at buf, releasing any
+  // buffer it owned.  The memory must outlive the block.
+  void UseBuffer(BYTE_T *buf, const SIZE_T len);
+
+  // Buffer pool
+  //
+  // ReservePool fixes the pool's buffer size (the first call wins)
+  // and makes sure at least count buffers have been preallocated.
+  // The pool grows on demand but never shrinks.
+  // returns ERROR_NOERROR, ERROR_NOMEM, or ERROR_SIZE if the pool
+  // already has a different size
+  static ERROR_T ReservePool(const SIZE_T size, const SIZE_T count);
+  // Raw buffers, from the pool if size is the pool size
+  static BYTE_T *GetBuffer(const SIZE_T size);
+  static void    PutBuffer(BYTE_T *buf, const SIZE_T size);
+
   bool operator<(const Block &rhs) const;
   bool operator==(const Block &rhs) const;
 
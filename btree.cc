@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <vector>
 #include <math.h>
+#include <string.h>
 KeyValuePair::KeyValuePair()
 {}
 
@@ -186,6 +187,16 @@ ERROR_T BTreeIndex::Detach(SIZE_T &initblock)
 }
  
 
+// Compare a key against a key stored in a node, without copying it out
+static int CompareKey(const KEY_T &key, const char *nodekey, const SIZE_T keysize)
+{
+  return memcmp(key.data,nodekey,keysize);
+}
+
+
+//
+// Lookups and updates work directly on pinned cache frames
+//
 ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
 					   const BTreeOp op,
 					   const KEY_T &key,
@@ -194,10 +205,9 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
   BTreeNode b;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T testkey;
   SIZE_T ptr;
 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Pin(buffercache,node);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
@@ -209,14 +219,13 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
     // Scan through key/ptr pairs
     //and recurse if possible
     for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey || key==testkey) {
+      if (CompareKey(key,b.ResolveKey(offset),b.info.keysize)<=0) {
         	// OK, so we now have the first key that's larger
         	// so we ned to recurse on the ptr immediately previous to 
         	// this one, if it exists
         	rc=b.GetPtr(offset,ptr);
         	if (rc) { return rc; }
+		b.Unpin();
 	        return LookupOrUpdateInternal(ptr,op,key,value);
       }
     }
@@ -224,6 +233,7 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
     if (b.info.numkeys>0) { 
       rc=b.GetPtr(b.info.numkeys,ptr);
       if (rc) { return rc; }
+      b.Unpin();
       return LookupOrUpdateInternal(ptr,op,key,value);
     } else {
       // There are no keys at all on this node, so nowhere to go
@@ -233,20 +243,15 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
   case BTREE_LEAF_NODE:
     // Scan through keys looking for matching value
     for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (testkey==key) { 
+      if (CompareKey(key,b.ResolveKey(offset),b.info.keysize)==0) { 
         	if (op==BTREE_OP_LOOKUP) { 
         	  return b.GetVal(offset,value);
         	} else if (op==BTREE_OP_UPDATE){ 
         	  // BTREE_OP_UPDATE
-        	  // WRITE ME
+		  // the value is written straight into the cached block
                  ERROR_T setValErr = b.SetVal(offset,value);
                  if(setValErr != ERROR_NOERROR) { return setValErr; }
-                 ERROR_T serializeBErr = b.Serialize(buffercache,node);
-                 if(serializeBErr != ERROR_NOERROR){ return serializeBErr; }
-                 return ERROR_NOERROR;
-        	  //return ERROR_UNIMPL;
+                 return b.Unpin(true);
         	}
       }
     }
@@ -845,7 +850,10 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
   ERROR_T rc;
   SIZE_T offset;
 
-  rc= b.Unserialize(buffercache,node);
+  // Whole tree walks (here, SanityCheck and RangeQuery) read with
+  // the scan hint, so they don't push the nodes point operations
+  // depend on out of the cache
+  rc= b.Unserialize(buffercache,node,BUFFER_ACCESS_SCAN);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
@@ -918,7 +926,7 @@ ERROR_T BTreeIndex::RangeQuery(const KEY_T &minKey, const KEY_T &maxKey, std::ve
   //check if 1) b is a tree? 2) in order? 3) balanced? 4) Does each node have a valid
   //use ratio?
 
-  rc= b.Unserialize(buffercache,superblock.info.rootnode);
+  rc= b.Unserialize(buffercache,superblock.info.rootnode,BUFFER_ACCESS_SCAN);
   std::vector<KEY_T> allKeys;
   std::vector<VALUE_T> allValues;
   if(rc) return rc;
@@ -948,7 +956,7 @@ ERROR_T BTreeIndex::SanityCheck() const
   //check if 1) b is a tree? 2) in order? 3) balanced? 4) Does each node have a valid
   //use ratio?
 
-  rc= b.Unserialize(buffercache,superblock.info.rootnode);
+  rc= b.Unserialize(buffercache,superblock.info.rootnode,BUFFER_ACCESS_SCAN);
   std::vector<KEY_T> allData;
   std::vector<VALUE_T> values;
   if (rc) return rc;
@@ -1001,7 +1009,7 @@ ERROR_T BTreeIndex::UseRatioCheck(const SIZE_T &node)const{
   ERROR_T rc;
   SIZE_T offset;
   VALUE_T value; 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Unserialize(buffercache,node,BUFFER_ACCESS_SCAN);
   if (rc!=ERROR_NOERROR) { 
       return rc;
   }
@@ -1051,7 +1059,7 @@ ERROR_T BTreeIndex::GetHeight(const SIZE_T &node, int &height)const{
   ERROR_T rc;
   SIZE_T offset;
   VALUE_T value; 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Unserialize(buffercache,node,BUFFER_ACCESS_SCAN);
   if (rc!=ERROR_NOERROR) { 
       return rc;
   }
@@ -1081,12 +1089,24 @@ ERROR_T BTreeIndex::InOrderCheck(const SIZE_T &node, std::vector<KEY_T> &allData
   ERROR_T rc;
   SIZE_T offset, i;
   VALUE_T value; 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Unserialize(buffercache,node,BUFFER_ACCESS_SCAN);
   if (rc!=ERROR_NOERROR) { 
       return rc;
   }
   if (b.info.numkeys>0 && b.info.nodetype != BTREE_LEAF_NODE) { 
     
+    // single step prefetch, only when the children are leaves: the
+    // next leaf is read in the background while we walk this one.
+    // Higher up the prefetched block would have to outlast a whole
+    // subtree in the scan ring, and would be evicted before use.
+    bool leafchildren=false;
+    BTreeNode child;
+    rc=b.GetPtr(0,ptr);
+    if (rc) { return rc; }
+    rc=child.Unserialize(buffercache,ptr,BUFFER_ACCESS_SCAN);
+    if (rc) { return rc; }
+    leafchildren = child.info.nodetype==BTREE_LEAF_NODE;
+
     for (offset=0;offset<=b.info.numkeys;offset++) { 
       //rc=b.GetKey(offset,testkey);
       //if (rc) {  return rc; }
@@ -1094,6 +1114,13 @@ ERROR_T BTreeIndex::InOrderCheck(const SIZE_T &node, std::vector<KEY_T> &allData
       if (rc) { return rc; }
       cerr << "getting ptr " << ptr << endl;
 
+      if (leafchildren && offset<b.info.numkeys) { 
+        SIZE_T nextptr;
+        if (b.GetPtr(offset+1,nextptr)==ERROR_NOERROR) { 
+          buffercache->PrefetchBlock(nextptr,BUFFER_ACCESS_SCAN);
+        }
+      }
+
       rc=InOrderCheck(ptr, allData, values);
       if (rc) { return rc; }
     }
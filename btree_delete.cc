@@ -1,35 +1,44 @@
 #include <stdlib.h>
 #include "btree.h"
+#include "cacheoptions.h"
 
 void usage() 
 {
-  cerr << "usage: btree_delete filestem cachesize key\n";
+  cerr << "usage: btree_delete [-p policy] [-s shards] [-d high,low] [-g gap] [-m pct] [-r max] [-t frames] [-a] [-w] [-l fast] [-i mode] [-q depth] filestem cachesize key\n";
+  CacheOptionsUsage(cerr);
 }
 
 
 int main(int argc, char **argv)
 {
+  CacheOptions opts;
+  int arg;
   char *filestem;
   SIZE_T cachesize;
   SIZE_T superblocknum;
   char *key;
 
-  if (argc!=4) { 
+  if ((arg=ParseCacheOptions(argc,argv,opts))<0 || argc-arg!=3) { 
     usage();
     return -1;
   }
 
-  filestem=argv[1];
-  cachesize=atoi(argv[2]);
-  key=argv[3];
+  filestem=argv[arg];
+  cachesize=atoi(argv[arg+1]);
+  key=argv[arg+2];
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  ScopedDisk disk(filestem);
+  BufferCache cache(disk.get(),cachesize,opts.policy,opts.shards);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
 
 
+  if ((rc=ApplyCacheOptions(cache,opts))!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+
   if ((rc=cache.Attach())!=ERROR_NOERROR) { 
     cerr << "Can't attach buffer cache due to error"<<rc<<endl;
     return -1;
@@ -1,35 +1,44 @@
 #include <stdlib.h>
 #include "btree.h"
+#include "cacheoptions.h"
 
 void usage() 
 {
-  cerr << "usage: btree_display filestem cachesize dot|normal\n";
+  cerr << "usage: btree_display [-p policy] [-s shards] [-d high,low] [-g gap] [-m pct] [-r max] [-t frames] [-a] [-w] [-l fast] [-i mode] [-q depth] filestem cachesize dot|normal\n";
+  CacheOptionsUsage(cerr);
 }
 
 
 int main(int argc, char **argv)
 {
+  CacheOptions opts;
+  int arg;
   char *filestem;
   bool dot;
   SIZE_T cachesize;
   SIZE_T superblocknum;
 
-  if (argc!=4) { 
+  if ((arg=ParseCacheOptions(argc,argv,opts))<0 || argc-arg!=3) { 
     usage();
     return -1;
   }
 
-  filestem=argv[1];
-  cachesize=atoi(argv[2]);
-  dot=argv[3][0]=='d' || argv[3][0]=='D';
+  filestem=argv[arg];
+  cachesize=atoi(argv[arg+1]);
+  dot=argv[arg+2][0]=='d' || argv[arg+2][0]=='D';
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  ScopedDisk disk(filestem);
+  BufferCache cache(disk.get(),cachesize,opts.policy,opts.shards);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
 
 
+  if ((rc=ApplyCacheOptions(cache,opts))!=ERROR_NOERROR) { 
+    usage();
+    return -1;
+  }
+
   if ((rc=cache.Attach())!=ERROR_NOERROR) { 
     cerr << "Can't attach buffer cache due to error"<<rc<<endl;
     return -1;
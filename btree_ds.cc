@@ -40,7 +40,21 @@ ostream & NodeMetadata::Print(ostream &os) const
   return os;
 }
 
-BTreeNode::BTreeNode() 
+// Node data buffers are a whole block long, even though the
+// metadata takes up the front of the block, so that they come out
+// of Block's buffer pool
+static char *NewNodeData(const SIZE_T blocksize)
+{
+  BYTE_T *d=Block::GetBuffer(blocksize);
+
+  if (!d) { 
+    throw GenericException();
+  }
+  return (char *) d;
+}
+
+
+BTreeNode::BTreeNode() : pincache(0), pinblock(0), pinframe(0)
 {
   info.nodetype=BTREE_UNALLOCATED_BLOCK;
   data=0;
@@ -48,15 +62,19 @@ BTreeNode::BTreeNode()
 
 BTreeNode::~BTreeNode()
 {
+  if (pincache) { 
+    Unpin();
+  }
   if (data) { 
-    delete [] data;
+    Block::PutBuffer((BYTE_T *) data,info.blocksize);
   }
   data=0;
   info.nodetype=BTREE_UNALLOCATED_BLOCK;
 }
 
 
-BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size)
+BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size) :
+  pincache(0), pinblock(0), pinframe(0)
 {
   info.nodetype=node_type;
   info.keysize=key_size;
@@ -67,12 +85,12 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
   info.numkeys=0;				       
   data=0;
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
+    data = NewNodeData(info.blocksize);
     memset(data,0,info.GetNumDataBytes());
   }
 }
 
-BTreeNode::BTreeNode(const BTreeNode &rhs) 
+BTreeNode::BTreeNode(const BTreeNode &rhs) : pincache(0), pinblock(0), pinframe(0)
 {
   info.nodetype=rhs.info.nodetype;
   info.keysize=rhs.info.keysize;
@@ -83,7 +101,7 @@ BTreeNode::BTreeNode(const BTreeNode &rhs)
   info.numkeys=rhs.info.numkeys;				       
   data=0;
   if (rhs.data) { 
-   data=new char [info.GetNumDataBytes()];
+    data=NewNodeData(info.blocksize);
     memcpy(data,rhs.data,info.GetNumDataBytes());
   }
 }
@@ -91,7 +109,12 @@ BTreeNode::BTreeNode(const BTreeNode &rhs)
 
 BTreeNode & BTreeNode::operator=(const BTreeNode &rhs) 
 {
-  return *(new (this) BTreeNode(rhs));
+  if (this!=&rhs) { 
+    // release our own data (and any pin) before copying
+    this->~BTreeNode();
+    new (this) BTreeNode(rhs);
+  }
+  return *this;
 }
 
 
@@ -99,6 +122,12 @@ ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
 {
   assert((unsigned)info.blocksize==b->GetBlockSize());
 
+  if (pincache==b && pinblock==blocknum) { 
+    // data already lives in the cached frame
+    memcpy(pinframe->data,&info,sizeof(info));
+    return b->MarkDirty(blocknum);
+  }
+
   Block block(sizeof(info)+info.GetNumDataBytes());
 
   memcpy(block.data,&info,sizeof(info));
@@ -110,36 +139,97 @@ ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
 }
 
 
-ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
+ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum,
+				const BufferAccessHint hint)
 {
-  Block block;
-
   ERROR_T rc;
 
-  rc=b->ReadBlock(blocknum,block);
+  // Copy straight out of the cached frame
+  rc=Pin(b,blocknum,hint);
 
   if (rc!=ERROR_NOERROR) {
     return rc;
   }
 
-  memcpy(&info,block.data,sizeof(info));
+  char *frame=data;
+
+  pincache=0;
+  data=0;
+
+  if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
+    data = NewNodeData(info.blocksize);
+    memcpy(data,frame,info.GetNumDataBytes());
+  }
   
+  return b->UnpinBlock(blocknum);
+}
+
+
+ERROR_T BTreeNode::Pin(BufferCache *b, const SIZE_T blocknum,
+		       const BufferAccessHint hint)
+{
+  ERROR_T rc;
+  Block  *frame;
+
+  if (pincache) { 
+    Unpin();
+  }
+
+  rc=b->PinBlock(blocknum,frame,hint);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
   if (data) { 
-    delete [] data;
+    Block::PutBuffer((BYTE_T *) data,info.blocksize);
     data=0;
   }
 
+  memcpy(&info,frame->data,sizeof(info));
+
   assert(b->GetBlockSize()==(unsigned)info.blocksize);
 
+  pincache=b;
+  pinblock=blocknum;
+  pinframe=frame;
+
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
-    memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    data = (char *) (frame->data+sizeof(info));
   }
-  
+
+  // every lookup and update walks the root and interior nodes, so
+  // keep them out of the way of leaf traffic.  The superblock is
+  // read once and then kept in memory by BTreeIndex.
+  if (hint==BUFFER_ACCESS_NORMAL && 
+      (info.nodetype==BTREE_ROOT_NODE || info.nodetype==BTREE_INTERIOR_NODE)) {
+    b->ProtectBlock(blocknum);
+  }
+
   return ERROR_NOERROR;
 }
 
 
+ERROR_T BTreeNode::Unpin(const bool dirty)
+{
+  BufferCache *b=pincache;
+
+  if (!b) { 
+    return ERROR_NOERROR;
+  }
+
+  if (dirty) { 
+    memcpy(pinframe->data,&info,sizeof(info));
+  }
+
+  pincache=0;
+  pinframe=0;
+  data=0;
+
+  return b->UnpinBlock(pinblock,dirty);
+}
+
+
 char * BTreeNode::ResolveKey(const SIZE_T offset) const
 {
   switch (info.nodetype) { 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "global.h"
 #include "block.h"
+#include "buffercache.h"
 
 using namespace std;
 
@@ -21,7 +22,6 @@ typedef KeyOrValue KEY_T;
 typedef KeyOrValue VALUE_T;
 
 
-class BufferCache;
 struct KeyValuePair;
 
 struct NodeMetadata {
@@ -65,6 +65,12 @@ struct BTreeNode {
   // unallocated or superblock => blank
   // interior => array of keys
   // leaf => array of key/value pairs
+  //
+  // When the node is pinned, data points straight into the
+  // buffer cache frame instead of at a private copy
+  BufferCache  *pincache;
+  SIZE_T        pinblock;
+  Block        *pinframe;
 
 
   BTreeNode();
@@ -79,7 +85,18 @@ struct BTreeNode {
   BTreeNode & operator=(const BTreeNode &rhs);
   
   ERROR_T Serialize(BufferCache *b, const SIZE_T block) const;
-  ERROR_T Unserialize(BufferCache *b, const SIZE_T block);
+  // hint tells the cache how the block is being used
+  ERROR_T Unserialize(BufferCache *b, const SIZE_T block,
+		      const BufferAccessHint hint=BUFFER_ACCESS_NORMAL);
+
+  // Pin makes this node a view onto the cached block, with no copying.
+  // Set* calls then modify the cached block directly; Unpin(true)
+  // writes info back and marks the block dirty.  The destructor
+  // unpins a node that is still pinned.  Copies of a pinned node
+  // are ordinary private copies.
+  ERROR_T Pin(BufferCache *b, const SIZE_T block,
+	      const BufferAccessHint hint=BUFFER_ACCESS_NORMAL);
+  ERROR_T Unpin(const bool dirty=false);
 
   char *ResolveKey(const SIZE_T offset) const; // Gives a pointer to the ith key  (interior or leaf)
   char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior)
@@ -1,258 +1,2990 @@
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest()
+
+// Longest run of blocks an eviction writes back in one request
+#define WRITEBACK_MAXRUN 32
+
+// Readahead: streams tracked at once, the first window, the
+// default largest window and the most it may be set to
+#define READAHEAD_STREAMS 8
+#define READAHEAD_INITIAL 4
+#define READAHEAD_DEFAULT 0
+#define READAHEAD_LIMIT   128
+
+// Share of a shard's frames scans may fill before they start
+// recycling their own, and the least they get
+#define SCANRING_FRACTION 8
+#define SCANRING_MIN      2
+
+// Admission window as a percentage of a shard's frames, and the
+// least it gets
+#define ADMISSION_WINDOW_PERCENT 1
+#define ADMISSION_WINDOW_MIN     1
+
+// Alignment of each frame in the arena
+#define FRAME_ALIGN 64
+
+// Block buffers the cache sets aside in Block's pool
+#define BLOCKPOOL_RESERVE 16
+
+// Most waiting prefetches scheduled as one batch, and most frames
+// written back in one batch for the flusher
+#define PREFETCH_BATCH 16
+#define FLUSH_BATCH    16
+
+// Simulated ms a queued prefetch may be passed over by the elevator
+#define PREFETCH_DEADLINE 500
+
+
+static bool frame_blocknum_lessthan(const BufferFrame *f1, const BufferFrame *f2)
+{
+  return f1->blocknum < f2->blocknum;
+}
+
+static bool frame_recency_greaterthan(const BufferFrame *f1, const BufferFrame *f2)
+{
+  return f1->block.lastaccessed > f2->block.lastaccessed;
+}
+
+
+//
+// Holds a mutex for the lifetime of a scope
+//
+class MutexHolder {
+ private:
+  pthread_mutex_t *m;
+ public:
+  MutexHolder(pthread_mutex_t *mutex) : m(mutex) { pthread_mutex_lock(m); }
+  ~MutexHolder() { pthread_mutex_unlock(m); }
+};
+
+
+CacheShard::CacheShard() :
+  numframes(0), bucketmask(0), policytype(CACHE_POLICY_LRU), clients(0), scanmax(0),
+  protmax(0), admission(false), windowmax(ADMISSION_WINDOW_MIN),
+  freeframes(0), numresident(0), dirtyhead(0), dirtytail(0), numdirty(0),
+  reads(0), writes(0), diskreads(0), diskwrites(0), prefetches(0), flushes(0),
+  diskwriterequests(0),
+  readaheads(0), readaheadhits(0), admitted(0), rejected(0)
+{
+  pthread_mutex_init(&lock,0);
+  pthread_cond_init(&iodone,0);
+}
+
+CacheShard::~CacheShard()
+{
+  for (SIZE_T i=0;i<policies.size();i++) {
+    delete policies[i];
+  }
+  pthread_cond_destroy(&iodone);
+  pthread_mutex_destroy(&lock);
+}
+
+void CacheShard::Init(const CachePolicyType pt, const vector<CacheClient> *c)
+{
+  policytype=pt;
+  clients=c;
+  buckets.assign(1,(BufferFrame*)0);
+  bucketmask=0;
+  policies.push_back(CachePolicy::Create(pt,1));
+  clientresident.push_back(0);
+  clientshare.push_back(0);
+  tried.push_back(false);
+}
+
+void CacheShard::AddFrames(BufferFrame *f, const SIZE_T n)
+{
+  for (SIZE_T i=n;i>0;i--) {
+    frames.push_back(&(f[i-1]));
+    f[i-1].next=freeframes;
+    freeframes=&(f[i-1]);
+  }
+}
+
+void CacheShard::SetSize(const SIZE_T n)
+{
+  SIZE_T numbuckets=1;
+
+  numframes=n;
+  while (numbuckets < 2*numframes) {
+    numbuckets<<=1;
+  }
+  if (numbuckets>buckets.size()) {
+    // rehash what is resident
+    buckets.assign(numbuckets,(BufferFrame*)0);
+    bucketmask=numbuckets-1;
+    for (SIZE_T i=0;i<frames.size();i++) {
+      if (frames[i]->inuse) {
+	HashInsert(frames[i]);
+      }
+    }
+  }
+  for (SIZE_T i=0;i<policies.size();i++) {
+    policies[i]->Resize(numframes);
+  }
+  // room for the block being scanned and one prefetched after it
+  scanmax=numframes/SCANRING_FRACTION;
+  if (scanmax<SCANRING_MIN) {
+    scanmax=SCANRING_MIN;
+  }
+  windowmax=numframes*ADMISSION_WINDOW_PERCENT/100;
+  if (windowmax<ADMISSION_WINDOW_MIN) {
+    windowmax=ADMISSION_WINDOW_MIN;
+  }
+  if (admission) {
+    sketch.SetCapacity(numframes);
+  }
+}
+
+void CacheShard::AddClient()
+{
+  SIZE_T c=policies.size();
+
+  policies.push_back(CachePolicy::Create(policytype,numframes));
+  clientresident.push_back(0);
+  clientshare.push_back(0);
+  tried.push_back(false);
+
+  for (SIZE_T i=0;i<frames.size();i++) {
+    BufferFrame *f=frames[i];
+    if (f->inuse && ClientFor(f->blocknum)==c) {
+      if (!f->scan && !f->protect && !f->windowed) {
+	policies[f->client]->Remove(f);
+	policies[c]->Insert(f);
+      }
+      clientresident[f->client]--;
+      clientresident[c]++;
+      f->client=c;
+    }
+  }
+}
+
+SIZE_T CacheShard::ClientFor(const SIZE_T blocknum) const
+{
+  for (SIZE_T c=1;c<clients->size();c++) {
+    const CacheClient &cl=(*clients)[c];
+    if (blocknum>=cl.first && blocknum-cl.first<cl.numblocks) {
+      return c;
+    }
+  }
+  return 0;
+}
+
+SIZE_T CacheShard::Hash(const SIZE_T blocknum) const
+{
+  // Multiplicative hashing; the table size is a power of two
+  return (blocknum*2654435761U) & bucketmask;
+}
+
+BufferFrame *CacheShard::Lookup(const SIZE_T blocknum) const
+{
+  BufferFrame *f;
+
+  for (f=buckets[Hash(blocknum)]; f; f=f->hashnext) { 
+    if (f->blocknum==blocknum) { 
+      return f;
+    }
+  }
+  return 0;
+}
+
+void CacheShard::HashInsert(BufferFrame *f)
+{
+  SIZE_T h=Hash(f->blocknum);
+
+  f->hashnext=buckets[h];
+  buckets[h]=f;
+}
+
+void CacheShard::HashRemove(BufferFrame *f)
+{
+  BufferFrame **p;
+
+  for (p=&(buckets[Hash(f->blocknum)]); *p; p=&((*p)->hashnext)) { 
+    if (*p==f) { 
+      *p=f->hashnext;
+      break;
+    }
+  }
+  f->hashnext=0;
+}
+
+// The caller must have made room with CheckDeleteOldest first
+BufferFrame *CacheShard::AllocateFrame(const SIZE_T blocknum, const double now,
+				       const bool scan)
+{
+  BufferFrame *f=freeframes;
+
+  if (!f) { 
+    return 0;
+  }
+  freeframes=f->next;
+  f->blocknum=blocknum;
+  f->block.dirty=false;
+  f->writeback=0;
+  f->block.lastaccessed=now;
+  f->iopending=false;
+  f->readytime=now;
+  f->inuse=true;
+  f->readahead=false;
+  f->client=ClientFor(blocknum);
+  HashInsert(f);
+  f->scan=scan;
+  if (scan) {
+    scanring.PushFront(f);
+  } else {
+    Admit(f);
+  }
+  clientresident[f->client]++;
+  numresident++;
+  return f;
+}
+
+void CacheShard::ReleaseFrame(BufferFrame *f)
+{
+  HashRemove(f);
+  if (f->protect) {
+    protring.Remove(f);
+    f->protect=false;
+  } else if (f->scan) {
+    scanring.Remove(f);
+    f->scan=false;
+  } else if (f->windowed) {
+    window.Remove(f);
+    f->windowed=false;
+  } else {
+    policies[f->client]->Remove(f);
+  }
+  clientresident[f->client]--;
+  SetClean(f);
+  f->inuse=false;
+  f->next=freeframes;
+  freeframes=f;
+  numresident--;
+}
+
+//
+// Scan frames are the coldest in the shard, so they go first.  A
+// scan takes frames from the policy only while it has fewer than
+// scanmax; after that it recycles its own.
+//
+BufferFrame *CacheShard::Victim(const SIZE_T incoming, const bool scan)
+{
+  BufferFrame *f=0;
+  bool ringfirst = !scan || scanring.size>=scanmax;
+
+  if (ringfirst) {
+    f=OldestEvictable(scanring);
+  }
+  if (!f) {
+    f = admission ? AdmissionVictim(incoming) : PolicyVictim(incoming);
+  }
+  if (!f && !ringfirst) {
+    f=OldestEvictable(scanring);
+  }
+  if (!f) {
+    // better that than nothing
+    f=OldestEvictable(protring);
+  }
+  return f;
+}
+
+//
+// With several clients, the one furthest over its share gives up a
+// frame first.  If nobody is borrowing, the client wanting the frame
+// makes its own room, and failing that anyone with an unpinned
+// frame does.
+//
+BufferFrame *CacheShard::PolicyVictim(const SIZE_T incoming)
+{
+  BufferFrame *f=0;
+  SIZE_T       c;
+
+  if (policies.size()==1) {
+    return policies[0]->Victim(incoming);
+  }
+  for (c=0;c<tried.size();c++) {
+    tried[c]=false;
+  }
+  while (!f) {
+    SIZE_T worst=policies.size(), over=0;
+
+    for (c=0;c<policies.size();c++) {
+      if (!tried[c] && clientresident[c]>clientshare[c] &&
+	  clientresident[c]-clientshare[c]>over) {
+	worst=c;
+	over=clientresident[c]-clientshare[c];
+      }
+    }
+    if (worst==policies.size()) {
+      break;
+    }
+    tried[worst]=true;
+    f=policies[worst]->Victim(incoming);
+  }
+  if (!f) {
+    f=policies[ClientFor(incoming)]->Victim(incoming);
+  }
+  for (c=0;!f && c<policies.size();c++) {
+    f=policies[c]->Victim(incoming);
+  }
+  return f;
+}
+
+//
+// TinyLFU admission.  Once the window is full, the frame leaving it
+// has to earn a place in the policy: it displaces the policy's
+// victim only if the sketch says it has been used more often, and
+// is evicted itself otherwise.  A dirty frame also wins against a
+// clean one, since turning it away would write it back on its own
+// instead of in a run with its neighbours.  A client under its
+// share always wins against another client's frame, so quotas
+// still hold.
+//
+BufferFrame *CacheShard::AdmissionVictim(const SIZE_T incoming)
+{
+  BufferFrame *candidate=0, *victim;
+
+  if (window.size>=windowmax) {
+    candidate=OldestEvictable(window);
+  }
+  victim=PolicyVictim(incoming);
+  if (!candidate) {
+    return victim ? victim : OldestEvictable(window);
+  }
+  if (!victim) {
+    return candidate;
+  }
+  if (sketch.Estimate(candidate->blocknum)>sketch.Estimate(victim->blocknum) ||
+      (candidate->block.dirty && !victim->block.dirty) ||
+      (candidate->client!=victim->client &&
+       clientresident[candidate->client]<=clientshare[candidate->client])) {
+    window.Remove(candidate);
+    candidate->windowed=false;
+    policies[candidate->client]->Insert(candidate);
+    admitted++;
+    return victim;
+  }
+  rejected++;
+  return candidate;
+}
+
+void CacheShard::Admit(BufferFrame *f)
+{
+  if (!admission) {
+    policies[f->client]->Insert(f);
+    return;
+  }
+  f->windowed=true;
+  window.PushFront(f);
+  // until the shard fills up, frames leave the window for the
+  // policy without having to win their place
+  while (window.size>windowmax) {
+    BufferFrame *w=window.tail;
+    window.Remove(w);
+    w->windowed=false;
+    policies[w->client]->Insert(w);
+  }
+}
+
+void CacheShard::Record(const SIZE_T blocknum)
+{
+  if (admission) {
+    sketch.Increment(blocknum);
+  }
+}
+
+void CacheShard::SetAdmission(const bool on)
+{
+  admission=on;
+  if (on) {
+    sketch.SetCapacity(numframes);
+    return;
+  }
+  while (window.size>0) {
+    BufferFrame *w=window.tail;
+    window.Remove(w);
+    w->windowed=false;
+    policies[w->client]->Insert(w);
+  }
+  sketch.SetCapacity(0);
+}
+
+void CacheShard::Promote(BufferFrame *f)
+{
+  scanring.Remove(f);
+  f->scan=false;
+  policies[f->client]->Insert(f);
+}
+
+void CacheShard::Protect(BufferFrame *f)
+{
+  if (protmax==0) {
+    return;
+  }
+  if (f->protect) {
+    protring.Remove(f);
+  } else if (f->scan) {
+    scanring.Remove(f);
+    f->scan=false;
+  } else if (f->windowed) {
+    window.Remove(f);
+    f->windowed=false;
+  } else {
+    policies[f->client]->Remove(f);
+  }
+  f->protect=true;
+  protring.PushFront(f);
+  SetProtected(protmax);
+}
+
+void CacheShard::SetProtected(const SIZE_T n)
+{
+  protmax=n;
+  while (protring.size>protmax) {
+    BufferFrame *f=protring.tail;
+    protring.Remove(f);
+    f->protect=false;
+    policies[f->client]->Insert(f);
+  }
+}
+
+void CacheShard::Reset()
+{
+  SIZE_T i;
+
+  for (i=0;i<buckets.size();i++) { 
+    buckets[i]=0;
+  }
+  for (i=0;i<policies.size();i++) {
+    policies[i]->Clear();
+    clientresident[i]=0;
+  }
+  scanring.Clear();
+  protring.Clear();
+  window.Clear();
+  sketch.Clear();
+  freeframes=0;
+  dirtyhead=dirtytail=0;
+  numdirty=0;
+  for (i=frames.size();i>0;i--) {
+    BufferFrame *f=frames[i-1];
+    f->prev=f->hashnext=0;
+    f->block.dirty=false;
+    f->dirtyprev=f->dirtynext=0;
+    f->ondirtylist=false;
+    f->writeback=0;
+    f->pincount=0;
+    f->iopending=false;
+    f->inuse=false;
+    f->scan=false;
+    f->protect=false;
+    f->windowed=false;
+    f->readahead=false;
+    f->client=0;
+    f->next=freeframes;
+    freeframes=f;
+  }
+  numresident=0;
+}
+
+void CacheShard::SetDirty(BufferFrame *f)
+{
+  f->block.dirty=true;
+  if (f->ondirtylist) {
+    return;
+  }
+  f->dirtyprev=0;
+  f->dirtynext=dirtyhead;
+  if (dirtyhead) {
+    dirtyhead->dirtyprev=f;
+  } else {
+    dirtytail=f;
+  }
+  dirtyhead=f;
+  f->ondirtylist=true;
+  numdirty++;
+}
+
+void CacheShard::SetClean(BufferFrame *f)
+{
+  f->block.dirty=false;
+  if (!f->ondirtylist) {
+    return;
+  }
+  if (f->dirtyprev) {
+    f->dirtyprev->dirtynext=f->dirtynext;
+  } else {
+    dirtyhead=f->dirtynext;
+  }
+  if (f->dirtynext) {
+    f->dirtynext->dirtyprev=f->dirtyprev;
+  } else {
+    dirtytail=f->dirtyprev;
+  }
+  f->dirtyprev=f->dirtynext=0;
+  f->ondirtylist=false;
+  numdirty--;
+}
+
+bool CacheShard::HasPendingIO() const
+{
+  for (SIZE_T i=0;i<frames.size();i++) {
+    if (frames[i]->iopending || frames[i]->writeback) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+CacheShard &BufferCache::ShardFor(const SIZE_T blocknum)
+{
+  return shards[blocknum%numshards];
+}
+
+void BufferCache::LockAllShards() const
+{
+  for (SIZE_T i=0;i<numshards;i++) {
+    pthread_mutex_lock(&(shards[i].lock));
+  }
+}
+
+void BufferCache::UnlockAllShards() const
+{
+  for (SIZE_T i=numshards;i>0;i--) {
+    pthread_mutex_unlock(&(shards[i-1].lock));
+  }
+}
+
+double BufferCache::Now() const
+{
+  MutexHolder t(&timelock);
+
+  return curtime;
+}
+
+// Feeds a demand reference to the miss ratio curve
+void BufferCache::Reference(const SIZE_T blocknum, const bool read)
+{
+  if (mrc) { 
+    MutexHolder l(&mrclock);
+    mrc->Access(blocknum,read);
+  }
+}
+
+void BufferCache::Touch(CacheShard &s, BufferFrame *f)
+{
+  f->block.lastaccessed=Now();
+  s.Record(f->blocknum);
+  if (f->protect) {
+    s.Protect(f);
+  } else if (f->scan) {
+    s.Promote(f);
+  } else if (f->windowed) {
+    s.window.Remove(f);
+    s.window.PushFront(f);
+  } else {
+    s.policies[f->client]->Touch(f);
+  }
+}
+
+
+//
+// Demand disk requests.  These wait for the simulated disk to
+// finish any prefetches ahead of them and then for their own
+// transfer.  The caller counts them in its shard.  A read is the
+// end of a miss, so it hands the worker what was scheduled.
+//
+ERROR_T BufferCache::DiskRead(const SIZE_T blocknum, Block &block)
+{
+  double  reqtime;
+  ERROR_T rc;
+
+  MutexHolder d(&disklock);
+
+  SchedulePrefetches();
+  rc=disk->Read(blocknum,block,reqtime);
+
+  pthread_mutex_lock(&timelock);
+  if (diskfreetime>curtime) {
+    curtime=diskfreetime;
+  }
+  curtime+=reqtime;
+  diskfreetime=curtime;
+  readtime+=reqtime;
+  timedreads++;
+  pthread_mutex_unlock(&timelock);
+
+  StartPrefetches();
+  return rc;
+}
+
+// Reads n consecutive blocks straight into their frames
+ERROR_T BufferCache::DiskRead(BufferFrame **run, const SIZE_T n)
+{
+  double  reqtime;
+  ERROR_T rc;
+
+  MutexHolder d(&disklock);
+
+  SchedulePrefetches();
+  rabuf.resize(n);
+  for (SIZE_T i=0;i<n;i++) { 
+    rabuf[i]=run[i]->block.data;
+  }
+  rc=disk->ReadV(run[0]->blocknum,n,&rabuf[0],reqtime);
+
+  pthread_mutex_lock(&timelock);
+  if (diskfreetime>curtime) {
+    curtime=diskfreetime;
+  }
+  curtime+=reqtime;
+  diskfreetime=curtime;
+  readtime+=reqtime;
+  timedreads++;
+  pthread_mutex_unlock(&timelock);
+
+  StartPrefetches();
+  return rc;
+}
+
+//
+// Second level cache requests.  These only wait for the fast
+// device, which is busy until l2freetime.
+//
+ERROR_T BufferCache::SecondLevelRead(const SIZE_T blocknum, Block &block)
+{
+  double  reqtime;
+  ERROR_T rc;
+
+  MutexHolder l(&l2lock);
+
+  if ((rc=l2->Read(blocknum,block,reqtime))!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  MutexHolder t(&timelock);
+
+  if (l2freetime>curtime) {
+    curtime=l2freetime;
+  }
+  curtime+=reqtime;
+  l2freetime=curtime;
+  return ERROR_NOERROR;
+}
+
+// Copies a clean block that is being evicted to the second level
+// cache.  Like a prefetch, the write keeps the fast device busy but
+// not the caller.  Scan blocks and readahead nobody used aren't
+// worth keeping.
+// Called with the frame's shard locked
+void BufferCache::Spill(const BufferFrame *f)
+{
+  double reqtime;
+
+  if (!l2 || f->block.dirty || f->scan || f->readahead || f->iopending) {
+    return;
+  }
+
+  MutexHolder l(&l2lock);
+
+  if (l2->Write(f->blocknum,f->block,reqtime)!=ERROR_NOERROR) {
+    return;
+  }
+
+  MutexHolder t(&timelock);
+
+  l2freetime = (curtime > l2freetime ? curtime : l2freetime) + reqtime;
+}
+
+
+// Writes a run of frames holding consecutive blocks straight from
+// the frames
+ERROR_T BufferCache::DiskWrite(const vector<BufferFrame*> &run)
+{
+  double  reqtime;
+  ERROR_T rc;
+
+  MutexHolder d(&disklock);
+
+  SchedulePrefetches();
+  for (SIZE_T i=0;i<run.size();i++) { 
+    runbuf[i]=run[i]->block.data;
+  }
+  rc=disk->WriteV(run.front()->blocknum,run.size(),&runbuf[0],reqtime);
+
+  MutexHolder t(&timelock);
+
+  if (diskfreetime>curtime) {
+    curtime=diskfreetime;
+  }
+  curtime+=reqtime;
+  diskfreetime=curtime;
+  return rc;
+}
+
+// Schedules a batch of write backs for the flusher, in elevator
+// order from the head.  Like prefetches they start once the disk is
+// free, but the caller's clock does not wait for them.
+void BufferCache::DiskWriteBehind(DiskBatch &b)
+{
+  SIZE_T n=b.reqs.size();
+
+  MutexHolder d(&disklock);
+
+  SchedulePrefetches();
+  for (SIZE_T i=0;i<n;i++) {
+    flushsched.Add(b.reqs[i].blocknum,&b.reqs[i],0);
+  }
+  flushnext.clear();
+  flushsched.Next(flushnext,n,disk->GetHeadBlock(),0);
+  b.ptrs.resize(n);
+  for (SIZE_T i=0;i<n;i++) {
+    b.ptrs[i]=(DiskRequest *)flushnext[i].tag;
+  }
+
+  // diskfreetime only moves under the disk lock, which we hold
+  MutexHolder t(&timelock);
+
+  for (SIZE_T i=0;i<n;i++) {
+    b.reqs[i].issue=curtime;
+  }
+  disk->Schedule(&b.ptrs[0],n,diskfreetime);
+  for (SIZE_T i=0;i<n;i++) {
+    if (b.reqs[i].finish>diskfreetime) {
+      diskfreetime=b.reqs[i].finish;
+    }
+  }
+}
+
+
+ERROR_T BufferCache::CheckDeleteOldest(CacheShard &s, const SIZE_T incoming,
+				       const bool scan)
+{
+  ERROR_T rc;
+
+  // Only delete if the shard is full.  It may be more than full if
+  // it shrank while frames were pinned.
+  while (s.numresident >= s.numframes) {
+    if ((rc=Evict(s,incoming,scan))!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::Evict(CacheShard &s, const SIZE_T incoming, const bool scan)
+{
+  // The policy picks the victim; pinned blocks have to stay
+  BufferFrame *oldest=s.Victim(incoming,scan);
+
+  if (!oldest) { 
+    return ERROR_NOSPACE;
+  }
+
+  // write and delete it
+
+  if (oldest->block.dirty) {
+    int rc=WriteCluster(s,oldest);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  Spill(oldest);
+  s.ReleaseFrame(oldest);
+  return ERROR_NOERROR;
+}
+
+
+// Writes a run of frames holding consecutive blocks as one request
+// and marks them clean
+// Called with the shards of all the frames locked
+ERROR_T BufferCache::WriteRun(const vector<BufferFrame*> &run)
+{
+  ERROR_T rc;
+
+  rc=DiskWrite(run);
+  ShardFor(run.front()->blocknum).diskwriterequests++;
+  for (vector<BufferFrame*>::const_iterator f=run.begin(); f!=run.end(); ++f) {
+    ShardFor((*f)->blocknum).diskwrites++;
+  }
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  for (vector<BufferFrame*>::const_iterator f=run.begin(); f!=run.end(); ++f) {
+    ShardFor((*f)->blocknum).SetClean(*f);
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Writes frames back in block number order, merging adjacent blocks
+// into one request.  Two runs separated by at most writebackgap
+// blocks are joined if every block in between is resident, since
+// rewriting a few clean blocks costs less than another request.
+//
+// Called with the shards of all the frames, and of any blocks that
+// might bridge a gap between them, locked
+//
+ERROR_T BufferCache::WriteBack(vector<BufferFrame*> &dirty)
+{
+  vector<BufferFrame*> run, gap;
+  SIZE_T  i, n;
+  ERROR_T rc;
+
+  sort(dirty.begin(),dirty.end(),frame_blocknum_lessthan);
+
+  for (i=0; i<dirty.size(); ) {
+    run.clear();
+    run.push_back(dirty[i++]);
+
+    while (i<dirty.size()) {
+      SIZE_T last=run.back()->blocknum;
+      SIZE_T next=dirty[i]->blocknum;
+
+      if (next-last-1 > writebackgap) {
+	break;
+      }
+      gap.clear();
+      for (n=last+1; n<next; n++) {
+	BufferFrame *g=ShardFor(n).Lookup(n);
+	if (!g || g->iopending || g->writeback) {
+	  break;
+	}
+	gap.push_back(g);
+      }
+      if (n<next) {
+	break;
+      }
+      run.insert(run.end(),gap.begin(),gap.end());
+      run.push_back(dirty[i++]);
+    }
+
+    if ((rc=WriteRun(run))!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Writes back an eviction victim along with the dirty blocks next to
+// it on disk, which costs little more than the victim alone and
+// saves their own write backs later.  Neighbours in other shards are
+// only taken if their shard can be locked without waiting.
+//
+// Called with s, the victim's shard, locked
+//
+ERROR_T BufferCache::WriteCluster(CacheShard &s, BufferFrame *victim)
+{
+  vector<BufferFrame*> run(1,victim), gap;
+  vector<CacheShard*>  locked;
+  SIZE_T  numblocks=disk->GetNumBlocks();
+  ERROR_T rc;
+  int     dir;
+
+  for (dir=1; dir>=-1; dir-=2) {
+    SIZE_T n=victim->blocknum;
+
+    gap.clear();
+    while (run.size()+gap.size() < WRITEBACK_MAXRUN) {
+      if ((dir<0 && n==0) || (dir>0 && n+1>=numblocks)) {
+	break;
+      }
+      n+=dir;
+
+      CacheShard &ns=ShardFor(n);
+      if (&ns!=&s && find(locked.begin(),locked.end(),&ns)==locked.end()) {
+	if (pthread_mutex_trylock(&ns.lock)) {
+	  break;
+	}
+	locked.push_back(&ns);
+      }
+
+      BufferFrame *g=ns.Lookup(n);
+      if (!g || g->iopending || g->writeback) {
+	break;
+      }
+      if (g->block.dirty) {
+	run.insert(run.end(),gap.begin(),gap.end());
+	gap.clear();
+	run.push_back(g);
+      } else {
+	gap.push_back(g);
+	if (gap.size()>writebackgap) {
+	  break;
+	}
+      }
+    }
+  }
+
+  rc=WriteBack(run);
+
+  for (vector<CacheShard*>::iterator l=locked.begin(); l!=locked.end(); ++l) {
+    pthread_mutex_unlock(&((*l)->lock));
+  }
+  return rc;
+}
+
+BufferCache::BufferCache(DiskSystem *d,
+			 SIZE_T cs,
+			 const CachePolicyType pt,
+			 const SIZE_T ns) :
+   disk(d), cachesize(cs), 
+   numframes(0),
+   clients(1),
+   protectsize(0),
+   shards(0), numshards(ns>0 ? ns : 1),
+   allocs(0), deallocs(0),
+   curtime(0), diskfreetime(0),
+   readtime(0), timedreads(0),
+   mrc(0),
+   readaheadmax(READAHEAD_DEFAULT), streams(READAHEAD_STREAMS), ratick(0),
+   l2(0), l2freetime(0),
+   warmrestart(false), attached(false), preloaded(0),
+   diskiomode(DISK_IO_PREAD),
+   workerrunning(false), workerstop(false),
+   prefetchbatches(0), prefetchbatchesdone(0),
+   prefetchsched(PREFETCH_DEADLINE),
+   writebackgap(0),
+   dirtyhigh(0), dirtylow(0),
+   flusherrunning(false), flusherstop(false),
+   flushbatches(0), flushbatchesdone(0)
+{
+  // a zero sized cache still needs a frame to stage the current block
+  SIZE_T size = cs>0 ? cs : 1;
+
+  pthread_mutex_init(&timelock,0);
+  pthread_mutex_init(&disklock,0);
+  pthread_mutex_init(&mrclock,0);
+  pthread_mutex_init(&ralock,0);
+  pthread_mutex_init(&l2lock,0);
+  pthread_mutex_init(&queuelock,0);
+  pthread_cond_init(&workready,0);
+  pthread_cond_init(&workdone,0);
+  pthread_mutex_init(&flushlock,0);
+  pthread_cond_init(&flushready,0);
+  pthread_cond_init(&flushdone,0);
+
+  // for ReadBlock copies, the flusher and other transient blocks;
+  // if another cache already fixed a different size we do without
+  Block::ReservePool(disk->GetBlockSize(),BLOCKPOOL_RESERVE);
+
+  // every shard needs at least one frame
+  if (numshards>size) {
+    numshards=size;
+  }
+  shards=new CacheShard[numshards];
+  for (SIZE_T i=0; i<numshards; i++) {
+    shards[i].Init(pt,&clients);
+  }
+  if (Grow(size)!=ERROR_NOERROR) {
+    throw GenericException();
+  }
+}
+
+
+BufferCache::~BufferCache()
+{
+  if (disk) { 
+    Detach();
+  }
+  StopFlusher();
+  StopWorker();
+  delete [] shards;
+  delete mrc;
+  delete l2;
+  for (SIZE_T i=0;i<extents.size();i++) {
+    delete [] extents[i].frames;
+    free(extents[i].arena);
+  }
+  for (SIZE_T i=0;i<flushpool.size();i++) {
+    delete flushpool[i];
+  }
+  pthread_cond_destroy(&flushdone);
+  pthread_cond_destroy(&flushready);
+  pthread_mutex_destroy(&flushlock);
+  for (SIZE_T i=0;i<prefetchpool.size();i++) {
+    delete prefetchpool[i];
+  }
+  pthread_cond_destroy(&workdone);
+  pthread_cond_destroy(&workready);
+  pthread_mutex_destroy(&queuelock);
+  pthread_mutex_destroy(&ralock);
+  pthread_mutex_destroy(&l2lock);
+  pthread_mutex_destroy(&mrclock);
+  pthread_mutex_destroy(&disklock);
+  pthread_mutex_destroy(&timelock);
+  disk=0; cachesize=0; curtime=0;
+}
+
+ERROR_T BufferCache::Attach()
+{
+  StopFlusher();
+  StopWorker();
+
+  LockAllShards();
+  for (SIZE_T i=0;i<numshards;i++) {
+    shards[i].Reset();
+  }
+  UnlockAllShards();
+  ResetReadahead();
+  if (l2) {
+    // the primary disk may have been changed behind our back
+    MutexHolder l(&l2lock);
+    l2->Clear();
+  }
+  attached=true;
+  if (warmrestart) {
+    return LoadWorkingSet();
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::Detach()
+{
+  // let outstanding write backs and prefetches land first
+  StopFlusher();
+  StopWorker();
+
+  LockAllShards();
+
+  // and in simulated time, wait for the disk to finish them
+  pthread_mutex_lock(&timelock);
+  if (diskfreetime>curtime) {
+    curtime=diskfreetime;
+  }
+  pthread_mutex_unlock(&timelock);
+
+  // write out all of our data and then throw it away
+  ERROR_T rc=FlushAllLocked();
+
+  if (rc!=ERROR_NOERROR) { 
+    UnlockAllShards();
+    return rc;
+  }
+  // only a cache that was in use has a working set worth keeping;
+  // the destructor detaches again
+  if (warmrestart && attached) {
+    rc=SaveWorkingSet();
+  }
+  attached=false;
+  for (SIZE_T i=0;i<numshards;i++) {
+    shards[i].Reset();
+  }
+  UnlockAllShards();
+  ResetReadahead();
+
+  // the cache starts cold next time
+  if (mrc) { 
+    MutexHolder m(&mrclock);
+    mrc->Forget();
+  }
+  return rc;
+}
+
+
+string BufferCache::WarmFileName() const
+{
+  return disk->GetFileStem()+".warm";
+}
+
+// Writes the numbers of the resident blocks, most recently used
+// first, leaving out what scans and unused readahead brought in
+// Called with all shards locked
+ERROR_T BufferCache::SaveWorkingSet()
+{
+  vector<BufferFrame*> resident;
+  FILE                *f;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    for (SIZE_T j=0;j<shards[i].frames.size();j++) {
+      BufferFrame *fr=shards[i].frames[j];
+      if (fr->inuse && !fr->scan && !fr->readahead && !fr->iopending) {
+	resident.push_back(fr);
+      }
+    }
+  }
+  stable_sort(resident.begin(),resident.end(),frame_recency_greaterthan);
+
+  if ((f=fopen(WarmFileName().c_str(),"w"))==0) {
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"# buffercache working set version 1\n");
+  fprintf(f,"# block numbers, most recently used first\n");
+  for (SIZE_T i=0;i<resident.size();i++) {
+    fprintf(f,"%u\n",resident[i]->blocknum);
+  }
+  if (fclose(f)!=0) {
+    return ERROR_NOFILE;
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Reads a saved working set back in.  The most recently used blocks
+// that fit are allocated least recent first, so the policy sees
+// them in the order they were used, and then read in block number
+// order with adjacent blocks in one request.  A missing file, or
+// blocks since freed, just make for a colder start.
+//
+ERROR_T BufferCache::LoadWorkingSet()
+{
+  vector<SIZE_T>       blocknums, chosen;
+  vector<SIZE_T>       room(numshards);
+  vector<BufferFrame*> loaded;
+  BufferFrame         *run[READAHEAD_LIMIT];
+  char                 line[64];
+  FILE                *f;
+  SIZE_T               i, n;
+  double               now;
+  ERROR_T              rc=ERROR_NOERROR;
+
+  preloaded=0;
+  if ((f=fopen(WarmFileName().c_str(),"r"))==0) {
+    return ERROR_NOERROR;
+  }
+  while (fgets(line,sizeof(line),f)) {
+    char         *end;
+    unsigned long b=strtoul(line,&end,10);
+
+    if (line[0]!='#' && end!=line && b<disk->GetNumBlocks()) {
+      blocknums.push_back(b);
+    }
+  }
+  fclose(f);
+
+  LockAllShards();
+  for (i=0;i<numshards;i++) {
+    room[i]=shards[i].numframes-shards[i].numresident;
+  }
+  for (i=0;i<blocknums.size();i++) {
+    SIZE_T sh=blocknums[i]%numshards;
+    if (room[sh]>0 && IsBlockAllocated(blocknums[i])) {
+      room[sh]--;
+      chosen.push_back(blocknums[i]);
+    }
+  }
+  now=Now();
+  for (i=chosen.size();i>0;i--) {
+    CacheShard &s=ShardFor(chosen[i-1]);
+    if (!s.Lookup(chosen[i-1])) {
+      loaded.push_back(s.AllocateFrame(chosen[i-1],now));
+    }
+  }
+  sort(loaded.begin(),loaded.end(),frame_blocknum_lessthan);
+
+  for (i=0;i<loaded.size();i+=n) {
+    for (n=0; i+n<loaded.size() && n<READAHEAD_LIMIT &&
+	   loaded[i+n]->blocknum==loaded[i]->blocknum+n; n++) {
+      run[n]=loaded[i+n];
+    }
+    if (rc==ERROR_NOERROR) {
+      rc=DiskRead(run,n);
+      ShardFor(run[0]->blocknum).diskreads++;
+      now=Now();
+    }
+    for (SIZE_T k=0;k<n;k++) {
+      CacheShard &s=ShardFor(run[k]->blocknum);
+      if (rc!=ERROR_NOERROR) {
+	s.ReleaseFrame(run[k]);
+      } else {
+	run[k]->block.lastaccessed=now;
+	run[k]->readytime=now;
+	s.SetClean(run[k]);
+	preloaded++;
+      }
+    }
+  }
+  UnlockAllShards();
+
+  // the cache is only warmer for it; a failed read leaves it colder
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T BufferCache::GetCacheSize() const
+{
+  return cachesize;
+}
+
+SIZE_T BufferCache::GetNumShards() const
+{
+  return numshards;
+}
+
+// Frames shard i gets out of size
+SIZE_T BufferCache::ShardSize(const SIZE_T i, const SIZE_T size) const
+{
+  return size/numshards + (i<size%numshards ? 1 : 0);
+}
+
+//
+// Gives each shard its part of size frames, allocating an extent
+// for any that are short.  The frames' data is carved out of the
+// extent's arena; should that fail, they fall back to blocks of
+// their own.
+// Called with all shards locked, or from the constructor
+//
+ERROR_T BufferCache::Grow(const SIZE_T size)
+{
+  SIZE_T      i, n=0, first;
+  SIZE_T      blocksize=disk->GetBlockSize();
+  SIZE_T      stride=(blocksize+FRAME_ALIGN-1)/FRAME_ALIGN*FRAME_ALIGN;
+  FrameExtent e;
+  void       *a;
+
+  for (i=0;i<numshards;i++) {
+    if (shards[i].frames.size()<ShardSize(i,size)) {
+      n+=ShardSize(i,size)-shards[i].frames.size();
+    }
+  }
+
+  if (n>0) {
+    e.frames=new (nothrow) BufferFrame[n];
+    if (!e.frames) {
+      return ERROR_NOMEM;
+    }
+    e.numframes=n;
+    e.arena=0;
+    e.arenasize=0;
+    if (blocksize>0 && 
+	posix_memalign(&a,sysconf(_SC_PAGESIZE),stride*n)==0) { 
+      e.arena=(BYTE_T *)a;
+      e.arenasize=stride*n;
+      for (i=0;i<n;i++) { 
+	e.frames[i].block.UseBuffer(e.arena+i*stride,blocksize);
+      }
+    } else {
+      for (i=0;i<n;i++) { 
+	e.frames[i].block.Resize(blocksize,false);
+      }
+    }
+    extents.push_back(e);
+    numframes+=n;
+
+    for (i=0, first=0; i<numshards; i++) {
+      if (shards[i].frames.size()<ShardSize(i,size)) {
+	SIZE_T k=ShardSize(i,size)-shards[i].frames.size();
+	shards[i].AddFrames(e.frames+first,k);
+	first+=k;
+      }
+    }
+
+    // write back may now send longer runs
+    MutexHolder d(&disklock);
+    runbuf.resize(numframes);
+  }
+
+  for (i=0;i<numshards;i++) {
+    shards[i].SetSize(ShardSize(i,size));
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Evicts until each shard is down to its size, then frees what
+// extents it can.  Pinned frames stay until they are unpinned, and
+// CheckDeleteOldest finishes the job.
+// Called with all shards locked
+//
+ERROR_T BufferCache::Shrink()
+{
+  ERROR_T rc;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    // make room for no block in particular
+    while (shards[i].numresident>shards[i].numframes) {
+      if ((rc=Evict(shards[i],GetNumBlocks(),false))!=ERROR_NOERROR) {
+	if (rc==ERROR_NOSPACE) {
+	  break;
+	}
+	return rc;
+      }
+    }
+  }
+  while (ReleaseExtent()) {
+  }
+  return ERROR_NOERROR;
+}
+
+//
+// Frees the newest extent if the shards can do without its frames
+// and none of them is pinned, evicting the blocks they hold
+// Called with all shards locked
+//
+bool BufferCache::ReleaseExtent()
+{
+  SIZE_T       i, j;
+  FrameExtent &e=extents.back();
+  BufferFrame *lo=e.frames, *hi=e.frames+e.numframes;
+
+  if (extents.size()==1) {
+    return false;
+  }
+  for (i=0;i<numshards;i++) {
+    SIZE_T mine=0;
+    for (j=0;j<shards[i].frames.size();j++) {
+      if (shards[i].frames[j]>=lo && shards[i].frames[j]<hi) {
+	mine++;
+      }
+    }
+    if (shards[i].frames.size()-mine<shards[i].numframes) {
+      return false;
+    }
+  }
+  for (j=0;j<e.numframes;j++) {
+    if (e.frames[j].inuse && 
+	(e.frames[j].pincount>0 || e.frames[j].iopending || e.frames[j].writeback)) {
+      return false;
+    }
+  }
+
+  for (j=0;j<e.numframes;j++) {
+    BufferFrame *f=&(e.frames[j]);
+    if (f->inuse) {
+      CacheShard &s=ShardFor(f->blocknum);
+      if (f->block.dirty && WriteCluster(s,f)!=ERROR_NOERROR) {
+	return false;
+      }
+      s.ReleaseFrame(f);
+    }
+  }
+
+  // drop the extent's frames from their shards and free lists
+  for (i=0;i<numshards;i++) {
+    CacheShard          &s=shards[i];
+    vector<BufferFrame*> keep;
+
+    s.freeframes=0;
+    for (j=s.frames.size();j>0;j--) {
+      BufferFrame *f=s.frames[j-1];
+      if (f>=lo && f<hi) {
+	continue;
+      }
+      keep.push_back(f);
+      if (!f->inuse) {
+	f->next=s.freeframes;
+	s.freeframes=f;
+      }
+    }
+    s.frames.assign(keep.rbegin(),keep.rend());
+  }
+
+  numframes-=e.numframes;
+  delete [] e.frames;
+  free(e.arena);
+  extents.pop_back();
+  return true;
+}
+
+// Splits each client's quota over the shards in proportion to their
+// sizes
+// Called with all shards locked
+void BufferCache::SplitQuotas()
+{
+  SIZE_T size = cachesize>0 ? cachesize : 1;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    for (SIZE_T c=0;c<clients.size();c++) {
+      shards[i].clientshare[c]=clients[c].quota*shards[i].numframes/size;
+    }
+  }
+}
+
+// Splits the protected tier over the shards, keeping it to at most
+// half of the cache
+// Called with all shards locked
+void BufferCache::SplitProtected()
+{
+  SIZE_T n = protectsize<cachesize/2 ? protectsize : cachesize/2;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    shards[i].SetProtected(ShardSize(i,n));
+  }
+}
+
+void BufferCache::SetProtectedSize(const SIZE_T n)
+{
+  LockAllShards();
+  protectsize=n;
+  SplitProtected();
+  UnlockAllShards();
+}
+
+void BufferCache::SetAdmission(const bool on)
+{
+  LockAllShards();
+  for (SIZE_T i=0;i<numshards;i++) {
+    shards[i].SetAdmission(on);
+  }
+  UnlockAllShards();
+}
+
+ERROR_T BufferCache::SetSecondLevel(const string &filestem)
+{
+  DiskSystem *fast;
+  FILE       *f;
+
+  // DiskSystem doesn't report a missing disk, so look first
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return ERROR_NOFILE;
+  }
+  fclose(f);
+
+  fast=DiskSystem::Open(filestem);
+  if (fast->GetBlockSize()!=GetBlockSize()) {
+    delete fast;
+    return ERROR_WRONGSIZEBLOCK;
+  }
+  if (fast->SetIOMode(diskiomode)!=ERROR_NOERROR) {
+    delete fast;
+    return ERROR_NOMEM;
+  }
+
+  LockAllShards();
+  pthread_mutex_lock(&l2lock);
+  delete l2;
+  l2=new SecondLevelCache(fast,disk->GetNumBlocks());
+  pthread_mutex_unlock(&l2lock);
+  UnlockAllShards();
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::SetDiskIOMode(const DiskIOMode mode)
+{
+  ERROR_T rc;
+
+  // background I/O finishes in the mode it was scheduled in
+  Settle(0);
+  LockAllShards();
+  pthread_mutex_lock(&disklock);
+  rc=disk->SetIOMode(mode);
+  pthread_mutex_unlock(&disklock);
+  if (rc==ERROR_NOERROR) {
+    pthread_mutex_lock(&l2lock);
+    if (l2) {
+      rc=l2->SetIOMode(mode);
+    }
+    pthread_mutex_unlock(&l2lock);
+  }
+  if (rc==ERROR_NOERROR) {
+    diskiomode=mode;
+  }
+  UnlockAllShards();
+  return rc;
+}
+
+void BufferCache::SetDiskQueueDepth(const SIZE_T depth)
+{
+  MutexHolder d(&disklock);
+
+  disk->SetQueueDepth(depth);
+}
+
+void BufferCache::SetWarmRestart(const bool on)
+{
+  warmrestart=on;
+}
+
+SIZE_T BufferCache::GetNumPreloaded() const
+{
+  return preloaded;
+}
+
+ERROR_T BufferCache::ProtectBlock(const SIZE_T blocknum)
+{
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f=s.Lookup(blocknum);
+
+  if (!f || f->iopending) {
+    return ERROR_NONEXISTENT;
+  }
+  s.Protect(f);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::SetCacheSize(const SIZE_T cs)
+{
+  SIZE_T  quotas=0;
+  ERROR_T rc;
+
+  for (SIZE_T c=0;c<clients.size();c++) {
+    quotas+=clients[c].quota;
+  }
+  if (cs<numshards || cs<quotas) {
+    return ERROR_SIZE;
+  }
+
+  Settle(0);
+  LockAllShards();
+  rc=Grow(cs);
+  if (rc==ERROR_NOERROR) {
+    cachesize=cs;
+    SplitQuotas();
+    SplitProtected();
+    rc=Shrink();
+  }
+  UnlockAllShards();
+  return rc;
+}
+
+ERROR_T BufferCache::AddClient(const SIZE_T first, const SIZE_T numblocks,
+			       const SIZE_T quota, SIZE_T &client)
+{
+  SIZE_T quotas=quota;
+
+  LockAllShards();
+  for (SIZE_T c=1;c<clients.size();c++) {
+    if (first<clients[c].first+clients[c].numblocks &&
+	clients[c].first<first+numblocks) {
+      UnlockAllShards();
+      return ERROR_CONFLICT;
+    }
+    quotas+=clients[c].quota;
+  }
+  if (quotas>cachesize) {
+    UnlockAllShards();
+    return ERROR_SIZE;
+  }
+  clients.push_back(CacheClient(first,numblocks,quota));
+  client=clients.size()-1;
+  for (SIZE_T i=0;i<numshards;i++) {
+    shards[i].AddClient();
+  }
+  SplitQuotas();
+  UnlockAllShards();
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::SetClientQuota(const SIZE_T client, const SIZE_T quota)
+{
+  SIZE_T quotas=quota;
+
+  LockAllShards();
+  if (client==0 || client>=clients.size()) {
+    UnlockAllShards();
+    return ERROR_NONEXISTENT;
+  }
+  for (SIZE_T c=1;c<clients.size();c++) {
+    if (c!=client) {
+      quotas+=clients[c].quota;
+    }
+  }
+  if (quotas>cachesize) {
+    UnlockAllShards();
+    return ERROR_SIZE;
+  }
+  clients[client].quota=quota;
+  SplitQuotas();
+  UnlockAllShards();
+  return ERROR_NOERROR;
+}
+
+SIZE_T BufferCache::GetClientResident(const SIZE_T client) const
+{
+  SIZE_T n=0;
+
+  LockAllShards();
+  if (client<clients.size()) {
+    for (SIZE_T i=0;i<numshards;i++) {
+      n+=shards[i].clientresident[client];
+    }
+  }
+  UnlockAllShards();
+  return n;
+}
+
+
+SIZE_T BufferCache::GetBlockSize() const
+{
+  return disk->GetBlockSize();
+}
+
+SIZE_T BufferCache::GetNumBlocks() const
+{
+  return disk->GetNumBlocks();
+}
+
+double BufferCache::GetCurrentTime() const
+{
+  return Now();
+}
+
+const char *BufferCache::GetPolicyName() const
+{
+  return shards[0].policies[0]->GetName();
+}
+
+SIZE_T BufferCache::GetArenaSize() const
+{
+  SIZE_T n=0;
+
+  LockAllShards();
+  for (SIZE_T i=0;i<extents.size();i++) {
+    n+=extents[i].arenasize;
+  }
+  UnlockAllShards();
+  return n;
+}
+
+void BufferCache::SetWritebackGap(const SIZE_T gap)
+{
+  LockAllShards();
+  writebackgap=gap;
+  UnlockAllShards();
+}
+
+ERROR_T BufferCache::SetDirtyWatermarks(const double high, const double low)
+{
+  if (high<0 || high>1 || low<0 || (high>0 && low>=high)) {
+    return ERROR_BADCONFIG;
+  }
+  StopFlusher();
+
+  MutexHolder l(&flushlock);
+
+  dirtyhigh=high;
+  dirtylow=low;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::EnableMissRatioCurve(const double rate)
+{
+  if (rate<0 || rate>1) {
+    return ERROR_BADCONFIG;
+  }
+
+  MutexHolder l(&mrclock);
+
+  delete mrc;
+  mrc = rate>0 ? new MissRatioCurve(disk->GetNumBlocks(),rate) : 0;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
+{
+  MutexHolder l(&disklock);
+
+  allocs++;
+  return disk->NotifyAllocateBlocks(outblocknum,1);
+}
+
+ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
+{
+  MutexHolder l(&disklock);
+
+  deallocs++;
+  return disk->NotifyDeallocateBlocks(inblocknum,1);
+}
+
+
+bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
+{
+  MutexHolder l(&disklock);
+
+  return disk->IsBlockAllocated(inblocknum);
+}
+
+ERROR_T BufferCache::AllocateBlocks(const SIZE_T num, const SIZE_T hint, SIZE_T &outfirst)
+{
+  MutexHolder l(&disklock);
+  ERROR_T rc=disk->AllocateBlocks(num,hint,outfirst);
+
+  if (rc==ERROR_NOERROR) { 
+    allocs+=num;
+  }
+  return rc;
+}
+
+SIZE_T BufferCache::GetNumFreeBlocks() const
+{
+  MutexHolder l(&disklock);
+
+  return disk->GetNumFreeBlocks();
+}
+
+
+// Finds the frame holding blocknum, reading it from disk on a miss
+// Called with the shard's lock held; drops it while reading
+ERROR_T BufferCache::FetchFrame(CacheShard &s, const SIZE_T blocknum, BufferFrame *&f,
+				const BufferAccessHint hint)
+{
+  ERROR_T rc;
+  bool    scan = hint==BUFFER_ACCESS_SCAN;
+
+  while (true) { 
+    f = s.Lookup(blocknum);
+
+    // Another thread or a prefetch is reading this block in, so wait
+    // for it.  If that read failed the frame is gone and we miss
+    if (f && f->iopending) {
+      WaitForIO(s);
+      continue;
+    }
+
+    if (f) {
+      // It's in  cache, just update its recency
+      pthread_mutex_lock(&timelock);
+      if (f->readytime>curtime) {
+	// prefetched, but it hasn't arrived yet in simulated time
+	curtime=f->readytime;
+      }
+      pthread_mutex_unlock(&timelock);
+      if (!scan) {
+	Touch(s,f);
+      }
+      if (f->readahead) {
+	f->readahead=false;
+	s.readaheadhits++;
+	ReadaheadHit(blocknum);
+      }
+      return ERROR_NOERROR;
+    }
+
+    // It's not in cache, so time to allocate it, once background
+    // I/O already under way has finished (see Settle)
+    if (Settle(&s)) {
+      continue;
+    }
+    rc=CheckDeleteOldest(s,blocknum,scan);
+    if (rc==ERROR_NOSPACE && s.HasPendingIO()) {
+      // every frame is pinned, but some only until their reads
+      // finish; wait for one and look again
+      WaitForIO(s);
+      continue;
+    }
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    break;
+  }
+
+  if (!IsBlockAllocated(blocknum)) { 
+    if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+      cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << blocknum<<endl;
+    }
+  }
+  f=s.AllocateFrame(blocknum,Now(),scan);
+  if (!f) { 
+    return ERROR_IMPLBUG;
+  }
+  if (!scan) {
+    s.Record(blocknum);
+  }
+
+  // read it from disk with the shard unlocked; the pin keeps the
+  // frame ours and iopending makes anyone else wanting it wait
+  f->iopending=true;
+  f->pincount++;
+
+  // a miss that continues a sequential stream reads ahead, unless
+  // the second level cache has the block
+  BufferFrame *run[READAHEAD_LIMIT];
+  SIZE_T       n=1;
+  bool         inl2=false, l2hit=false;
+
+  if (l2) {
+    MutexHolder l(&l2lock);
+    inl2=l2->Contains(blocknum);
+  }
+  if (readaheadmax>1 && !inl2) {
+    n=ReadaheadWindow(blocknum);
+    if (n>1) {
+      run[0]=f;
+      n=ReadAhead(s,run,n,scan);
+      ReadaheadIssued(blocknum,n);
+    }
+  }
+  pthread_mutex_unlock(&s.lock);
+
+  if (n>1) {
+    rc = DiskRead(run,n);
+  } else if (inl2 && SecondLevelRead(blocknum,f->block)==ERROR_NOERROR) {
+    // (a copy overwritten since we looked falls through to the disk)
+    rc = ERROR_NOERROR;
+    l2hit = true;
+  } else {
+    rc = DiskRead(blocknum,f->block);
+  }
+  double now = Now();
+
+  // hand over the blocks read ahead, each under its shard's lock
+  for (SIZE_T k=1;k<n;k++) {
+    CacheShard &t=ShardFor(run[k]->blocknum);
+    MutexHolder l(&t.lock);
+    run[k]->iopending=false;
+    run[k]->pincount--;
+    if (rc!=ERROR_NOERROR) {
+      t.ReleaseFrame(run[k]);
+    } else {
+      run[k]->block.lastaccessed=now;
+      t.SetClean(run[k]);
+      run[k]->readytime=now;
+    }
+    pthread_cond_broadcast(&t.iodone);
+  }
+
+  pthread_mutex_lock(&s.lock);
+  f->iopending=false;
+  f->pincount--;
+  if (!l2hit) {
+    s.diskreads++;
+  }
+  pthread_cond_broadcast(&s.iodone);
+
+  if (rc!=ERROR_NOERROR) { 
+    s.ReleaseFrame(f);
+    f=0;
+    return rc;
+  }
+  f->block.lastaccessed=now;
+  s.SetClean(f);
+  f->readytime=now;
+  return ERROR_NOERROR;
+}
+
+//
+// Sequential readahead
+//
+// A miss on the block a stream expects next continues the stream.
+// Its first continuation starts readahead with a small window; on
+// each later one the window doubles if everything read ahead last
+// time has been used, and halves if less than half of it has.
+// A stream whose window shrinks to nothing starts over.
+//
+// Returns how many blocks, starting at blocknum, to read
+//
+SIZE_T BufferCache::ReadaheadWindow(const SIZE_T blocknum)
+{
+  MutexHolder      l(&ralock);
+  ReadaheadStream *st=0, *lru=&(streams[0]);
+  SIZE_T           n;
+
+  ratick++;
+  for (SIZE_T i=0;i<streams.size();i++) {
+    if (streams[i].lastuse>0 && streams[i].next==blocknum) {
+      st=&(streams[i]);
+    }
+    if (streams[i].lastuse<lru->lastuse) {
+      lru=&(streams[i]);
+    }
+  }
+
+  if (!st) {
+    // perhaps the start of a new one
+    *lru=ReadaheadStream();
+    lru->next=blocknum+1;
+    lru->lastuse=ratick;
+    return 1;
+  }
+
+  st->lastuse=ratick;
+  if (st->window==0) {
+    st->window=READAHEAD_INITIAL;
+  } else if (st->issued>0) {
+    if (2*st->used < st->issued) {
+      st->window/=2;
+    } else if (st->used==st->issued) {
+      st->window*=2;
+    }
+  }
+  if (st->window>readaheadmax) {
+    st->window=readaheadmax;
+  }
+  if (st->window<2) {
+    st->window=0;
+  }
+  st->next=blocknum+1;
+  st->start=blocknum+1;
+  st->issued=0;
+  st->used=0;
+
+  // leave most of the cache to everything else
+  n = st->window<cachesize/2 ? st->window : cachesize/2;
+  return n>1 ? n : 1;
+}
+
+// Records how many blocks after blocknum were actually read ahead
+void BufferCache::ReadaheadIssued(const SIZE_T blocknum, const SIZE_T n)
+{
+  MutexHolder l(&ralock);
+
+  for (SIZE_T i=0;i<streams.size();i++) {
+    if (streams[i].start==blocknum+1 && streams[i].issued==0) {
+      streams[i].issued=n-1;
+      return;
+    }
+  }
+}
+
+// A block that was read ahead has been read
+void BufferCache::ReadaheadHit(const SIZE_T blocknum)
+{
+  MutexHolder l(&ralock);
+
+  for (SIZE_T i=0;i<streams.size();i++) {
+    ReadaheadStream &st=streams[i];
+    if (blocknum>=st.start && blocknum<st.start+st.issued) {
+      st.used++;
+      if (blocknum>=st.next) {
+	st.next=blocknum+1;
+      }
+      st.lastuse=++ratick;
+    }
+  }
+}
+
+//
+// Claims frames for up to n-1 blocks following run[0], pinned and
+// marked I/O pending, and returns the length of the run
+//
+// Stops at the end of the disk, at a block that is already cached,
+// and where a frame can't be had without writing something back or
+// waiting for another shard's lock.
+// Called with s, the shard of run[0], locked
+//
+SIZE_T BufferCache::ReadAhead(CacheShard &s, BufferFrame **run, const SIZE_T n,
+			      const bool scan)
+{
+  SIZE_T k, limit=n;
+  double now=Now();
+
+  // don't let a scan push its own blocks out before it gets to them
+  if (scan && limit>s.scanmax*numshards) {
+    limit=s.scanmax*numshards;
+  }
+
+  for (k=1; k<limit; k++) {
+    SIZE_T       blocknum=run[0]->blocknum+k;
+    BufferFrame *f=0;
+
+    // only blocks that hold something
+    if (blocknum>=disk->GetNumBlocks() || !IsBlockAllocated(blocknum)) {
+      break;
+    }
+    CacheShard &t=ShardFor(blocknum);
+    if (&t!=&s && pthread_mutex_trylock(&t.lock)) {
+      break;
+    }
+    if (!t.Lookup(blocknum)) {
+      if (t.numresident>=t.numframes) {
+	BufferFrame *v=t.Victim(blocknum,scan);
+	if (v && !v->block.dirty) {
+	  Spill(v);
+	  t.ReleaseFrame(v);
+	}
+      }
+      if (t.numresident<t.numframes) {
+	f=t.AllocateFrame(blocknum,now,scan);
+      }
+    }
+    if (f) {
+      f->iopending=true;
+      f->pincount++;
+      f->readahead=true;
+      t.readaheads++;
+    }
+    if (&t!=&s) {
+      pthread_mutex_unlock(&t.lock);
+    }
+    if (!f) {
+      break;
+    }
+    run[k]=f;
+  }
+  return k;
+}
+
+void BufferCache::ResetReadahead()
+{
+  MutexHolder l(&ralock);
+
+  for (SIZE_T i=0;i<streams.size();i++) {
+    streams[i]=ReadaheadStream();
+  }
+  ratick=0;
+}
+
+void BufferCache::SetReadahead(const SIZE_T max)
+{
+  readaheadmax = max<READAHEAD_LIMIT ? max : READAHEAD_LIMIT;
+  ResetReadahead();
+}
+
+ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock,
+			       const BufferAccessHint hint) 
+{
+  CacheShard &s=ShardFor(inblocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
+  ERROR_T rc;
+
+  rc=FetchFrame(s,inblocknum,f,hint);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  if (hint==BUFFER_ACCESS_PROTECT) {
+    s.Protect(f);
+  }
+  outblock=f->block;
+  s.reads++;
+  Reference(inblocknum,true);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
+{
+  CacheShard &s=ShardFor(inblocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
+  ERROR_T rc;
+
+  if (inblock.length!=GetBlockSize()) { 
+    return ERROR_WRONGSIZEBLOCK;
+  }
+
+  while (true) { 
+    f = s.Lookup(inblocknum);
+
+    // don't let a read land on top of the new contents
+    if (f && f->iopending) {
+      WaitForIO(s);
+      continue;
+    }
+
+    if (f) {
+      // It's in  cache, so just replace the block
+      // (in place, so pointers held by pinners stay valid)
+      memcpy(f->block.data,inblock.data,inblock.length);
+      MarkFrameDirty(s,f);
+      Touch(s,f);
+      s.writes++;
+      Reference(inblocknum,false);
+      return ERROR_NOERROR;
+    }
+
+    // It's not in cache, so time to allocate it
+    if (Settle(&s)) {
+      continue;
+    }
+    rc=CheckDeleteOldest(s,inblocknum);
+    if (rc==ERROR_NOSPACE && s.HasPendingIO()) {
+      WaitForIO(s);
+      continue;
+    }
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    break;
+  }
+
+  if (!IsBlockAllocated(inblocknum)) { 
+    if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+      cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
+    }
+  }
+  double now=Now();
+  f=s.AllocateFrame(inblocknum,now);
+  if (!f) { 
+    return ERROR_IMPLBUG;
+  }
+  s.Record(inblocknum);
+  if (f->block.Resize(inblock.length,false)!=ERROR_NOERROR) { 
+    s.ReleaseFrame(f);
+    return ERROR_NOMEM;
+  }
+  memcpy(f->block.data,inblock.data,inblock.length);
+  f->block.lastaccessed=now;
+  MarkFrameDirty(s,f);
+  s.writes++;
+  Reference(inblocknum,false);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::PinBlock(const SIZE_T blocknum, Block *&frame,
+			      const BufferAccessHint hint)
+{
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
+  ERROR_T rc;
+
+  rc=FetchFrame(s,blocknum,f,hint);
+
+  if (rc!=ERROR_NOERROR) { 
+    frame=0;
+    return rc;
+  }
+  if (hint==BUFFER_ACCESS_PROTECT) {
+    s.Protect(f);
+  }
+  f->pincount++;
+  frame=&(f->block);
+  s.reads++;
+  Reference(blocknum,true);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::UnpinBlock(const SIZE_T blocknum, const bool dirty)
+{
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
+
+  f = s.Lookup(blocknum);
+
+  if (!f || f->pincount==0 || f->iopending) {
+    return ERROR_NONEXISTENT;
+  }
+  if (dirty) { 
+    MarkFrameDirty(s,f);
+    f->block.lastaccessed=Now();
+    s.writes++;
+  }
+  f->pincount--;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::MarkDirty(const SIZE_T blocknum)
 {
-  // In a real buffer cache, we would use a priority queue to make this O(1)
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
 
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr=blockmap.end();
-  double oldest = curtime+1;
+  f = s.Lookup(blocknum);
 
-  // Only delete if the cache is full
-  if (blockmap.size() < cachesize) {
-    return ERROR_NOERROR;
+  if (!f || f->pincount==0 || f->iopending) {
+    return ERROR_NONEXISTENT;
   }
+  MarkFrameDirty(s,f);
+  f->block.lastaccessed=Now();
+  s.writes++;
+  return ERROR_NOERROR;
+}
 
-  // Find oldest
-
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-       if ((*i).second.lastaccessed<oldest) { 
-	 oldestptr=i;
-	 oldest=(*i).second.lastaccessed;
-       }
-  }
-  
-  // write and delete it if it exists
- 
-  if (oldestptr!=blockmap.end()) { 
-    if ((*oldestptr).second.dirty) {
-      double reqtime;
-      int rc=disk->Write((*oldestptr).first,
-			 (*oldestptr).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
+ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum,
+				    const BufferAccessHint hint)
+{
+  BufferFrame *f;
+  bool         scan = hint==BUFFER_ACCESS_SCAN;
+
+  if (blocknum>=disk->GetNumBlocks()) {
+    return ERROR_NOSUCHBLOCK;
+  }
+
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+
+  while (true) {
+    if (s.Lookup(blocknum)) {
+      // already resident or on its way
+      return ERROR_NOERROR;
+    }
+    if (s.numresident < s.numframes || !Settle(&s)) {
+      break;
     }
-    blockmap.erase(oldestptr);
   }
-  return ERROR_NOERROR;
-}
 
-BufferCache::BufferCache(DiskSystem *d,
-			 SIZE_T cs) : 
-   disk(d), cachesize(cs), curtime(0),
-   allocs(0), deallocs(0), reads(0), writes(0),
-   diskreads(0), diskwrites(0)
-{}
+  if (s.numresident >= s.numframes) {
+    // We may reuse the victim, but only if it is clean, since
+    // writing it back would make us synchronous
+    BufferFrame *oldest=s.Victim(blocknum,scan);
+
+    if (!oldest || oldest->block.dirty) {
+      return ERROR_NOFETCH;
+    }
+    Spill(oldest);
+    s.ReleaseFrame(oldest);
+    if (s.numresident >= s.numframes) {
+      // still over after a shrink
+      return ERROR_NOFETCH;
+    }
+  }
 
+  f=s.AllocateFrame(blocknum,Now(),scan);
+  if (!f) { 
+    return ERROR_NOFETCH;
+  }
+  if (hint==BUFFER_ACCESS_PROTECT) {
+    s.Protect(f);
+  }
 
-BufferCache::~BufferCache()
-{
-  if (disk) { 
-    Detach();
+  // The worker holds a pin on the frame until the data is in
+  // readytime is the issue time until the read completes
+  f->iopending=true;
+  f->pincount=1;
+
+  pthread_mutex_lock(&queuelock);
+  if (!workerrunning) {
+    workerstop=false;
+    if (pthread_create(&worker,0,PrefetchWorker,this)) {
+      pthread_mutex_unlock(&queuelock);
+      f->iopending=false;
+      f->pincount=0;
+      s.ReleaseFrame(f);
+      return ERROR_NOFETCH;
+    }
+    workerrunning=true;
   }
-  disk=0; cachesize=0; curtime=0;
-}
+  pthread_mutex_unlock(&queuelock);
+  s.prefetches++;
 
-ERROR_T BufferCache::Attach()
-{
-  blockmap.clear();
+  MutexHolder d(&disklock);
+
+  prefetchsched.Add(blocknum,f,f->readytime);
   return ERROR_NOERROR;
 }
 
-ERROR_T BufferCache::Detach()
+//
+// Sends the prefetches waiting in the elevator to the simulated
+// disk, up to PREFETCH_BATCH at a time in sweep order from where the
+// head is (see DiskScheduler).  Each starts once it was issued and
+// the disk is free of earlier work; its finish is when the frame
+// will be ready.  The batches wait for StartPrefetches.
+// Called with disklock held
+//
+void BufferCache::SchedulePrefetches()
 {
-  // write out all of our data and then throw it away
+  while (!prefetchsched.Empty()) {
+    DiskBatch *b;
+    double     now;
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-    if ((*i).second.dirty) { 
-      double reqtime;
-      int rc=disk->Write((*i).first,
-			 (*i).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
+    pthread_mutex_lock(&queuelock);
+    if (prefetchpool.empty()) {
+      b=new DiskBatch;
+    } else {
+      b=prefetchpool.back();
+      prefetchpool.pop_back();
+    }
+    pthread_mutex_unlock(&queuelock);
+
+    pthread_mutex_lock(&timelock);
+    now=diskfreetime;
+    pthread_mutex_unlock(&timelock);
+
+    prefetchnext.clear();
+    prefetchsched.Next(prefetchnext,PREFETCH_BATCH,disk->GetHeadBlock(),now);
+
+    // the frames are pinned, so their block numbers can't change
+    // under us
+    SIZE_T n=prefetchnext.size();
+
+    b->reqs.resize(n);
+    b->ptrs.resize(n);
+    for (SIZE_T i=0;i<n;i++) {
+      BufferFrame *f=(BufferFrame *)prefetchnext[i].tag;
+      b->reqs[i].blocknum=f->blocknum;
+      b->reqs[i].block=&(f->block);
+      b->reqs[i].write=false;
+      b->reqs[i].issue=prefetchnext[i].arrival;
+      b->reqs[i].tag=f;
+      b->ptrs[i]=&b->reqs[i];
+    }
+    disk->Schedule(&b->ptrs[0],n,now);
+
+    pthread_mutex_lock(&timelock);
+    for (SIZE_T i=0;i<n;i++) {
+      if (b->reqs[i].finish>diskfreetime) {
+	diskfreetime=b->reqs[i].finish;
       }
     }
+    pthread_mutex_unlock(&timelock);
+
+    prefetchheld.push_back(b);
   }
-  blockmap.clear();
-  return ERROR_NOERROR;
 }
 
-
-SIZE_T BufferCache::GetCacheSize() const
+// Hands the scheduled batches of prefetches to the worker
+// Called with disklock held
+void BufferCache::StartPrefetches()
 {
-  return cachesize;
-}
+  if (prefetchheld.empty()) {
+    return;
+  }
 
+  MutexHolder q(&queuelock);
 
-SIZE_T BufferCache::GetBlockSize() const
-{
-  return disk->GetBlockSize();
+  for (SIZE_T i=0;i<prefetchheld.size();i++) {
+    prefetchqueue.push_back(prefetchheld[i]);
+    prefetchbatches++;
+  }
+  prefetchheld.clear();
+  pthread_cond_signal(&workready);
 }
 
-SIZE_T BufferCache::GetNumBlocks() const
+//
+// Waits, with s unlocked, for the worker and the flusher to finish
+// every batch handed to them so far.  Callers do this before choosing a victim, so
+// that which frames background I/O still has pinned follows from
+// simulated time alone, not from how far the threads have got.
+// s may be zero if the caller holds no shard lock.
+// returns true if it had to wait, in which case s was unlocked for
+// a while and the caller should look again
+//
+bool BufferCache::Settle(CacheShard *s)
 {
-  return disk->GetNumBlocks();
+  SIZE_T prefetches, flushes;
+  bool   busy;
+
+  pthread_mutex_lock(&disklock);
+  StartPrefetches();
+  pthread_mutex_unlock(&disklock);
+
+  pthread_mutex_lock(&queuelock);
+  prefetches=prefetchbatches;
+  busy=prefetchbatchesdone<prefetches;
+  pthread_mutex_unlock(&queuelock);
+  pthread_mutex_lock(&flushlock);
+  flushes=flushbatches;
+  busy=busy || flushbatchesdone<flushes;
+  pthread_mutex_unlock(&flushlock);
+
+  if (!busy) {
+    return false;
+  }
+  if (s) {
+    pthread_mutex_unlock(&s->lock);
+  }
+  pthread_mutex_lock(&queuelock);
+  while (prefetchbatchesdone<prefetches) {
+    pthread_cond_wait(&workdone,&queuelock);
+  }
+  pthread_mutex_unlock(&queuelock);
+  pthread_mutex_lock(&flushlock);
+  while (flushbatchesdone<flushes) {
+    pthread_cond_wait(&flushdone,&flushlock);
+  }
+  pthread_mutex_unlock(&flushlock);
+  if (s) {
+    pthread_mutex_lock(&s->lock);
+  }
+  return true;
 }
 
-double BufferCache::GetCurrentTime() const
+// Waits for a read or write back of one of s's frames, first
+// sending the disk any prefetch still waiting, since that could be
+// the one
+// Called with s locked; drops it while waiting
+void BufferCache::WaitForIO(CacheShard &s)
 {
-  return curtime;
+  pthread_mutex_lock(&disklock);
+  SchedulePrefetches();
+  StartPrefetches();
+  pthread_mutex_unlock(&disklock);
+  pthread_cond_wait(&s.iodone,&s.lock);
 }
 
-ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
+
+void *BufferCache::PrefetchWorker(void *cache)
 {
-  allocs++;
-  return disk->NotifyAllocateBlocks(outblocknum,1);
+  ((BufferCache *)cache)->PrefetchLoop();
+  return 0;
 }
 
-ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
+//
+// Body of the background prefetch thread
+//
+// It takes scheduled batches off the prefetch queue and fills their
+// frames from disk without holding any shard lock, so callers are
+// not held up.  With an asynchronous disk a batch is in flight all
+// at once.  The simulated times were fixed when the batch was
+// scheduled: each frame is ready when its own read finishes, which
+// with a queueing disk may be before others issued ahead of it.
+//
+void BufferCache::PrefetchLoop()
 {
-  deallocs++;
-  return disk->NotifyDeallocateBlocks(inblocknum,1);
+  vector<DiskRequest *> done;
+
+  pthread_mutex_lock(&queuelock);
+
+  while (true) {
+    while (prefetchqueue.empty() && !workerstop) {
+      pthread_cond_wait(&workready,&queuelock);
+    }
+    if (prefetchqueue.empty()) {
+      // told to stop and nothing left to do
+      break;
+    }
+
+    DiskBatch *b=prefetchqueue.front();
+    SIZE_T     n=b->reqs.size();
+
+    prefetchqueue.pop_front();
+    pthread_mutex_unlock(&queuelock);
+
+    ERROR_T rc;
+
+    pthread_mutex_lock(&disklock);
+    rc=disk->Start(&b->ptrs[0],n);
+    done.clear();
+    if (rc==ERROR_NOERROR) {
+      rc=disk->Reap(done,n);
+    }
+    pthread_mutex_unlock(&disklock);
+
+    for (SIZE_T i=0;i<n;i++) {
+      DiskRequest &r=b->reqs[i];
+      BufferFrame *f=(BufferFrame *)r.tag;
+      CacheShard  &s=ShardFor(f->blocknum);
+
+      pthread_mutex_lock(&s.lock);
+      s.diskreads++;
+      f->iopending=false;
+      f->pincount--;
+      if (rc!=ERROR_NOERROR || r.rc!=ERROR_NOERROR) { 
+	s.ReleaseFrame(f);
+      } else {
+	f->readytime=r.finish;
+	f->block.lastaccessed=r.finish;
+	s.SetClean(f);
+      }
+      pthread_cond_broadcast(&s.iodone);
+      pthread_mutex_unlock(&s.lock);
+    }
+
+    pthread_mutex_lock(&queuelock);
+    prefetchpool.push_back(b);
+    prefetchbatchesdone++;
+    pthread_cond_broadcast(&workdone);
+  }
+
+  pthread_mutex_unlock(&queuelock);
 }
 
+// Schedules what prefetches are left, drains the prefetch queue and
+// waits for the worker to exit
+void BufferCache::StopWorker()
+{
+  pthread_mutex_lock(&disklock);
+  SchedulePrefetches();
+  StartPrefetches();
+  pthread_mutex_unlock(&disklock);
 
-bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
+  pthread_mutex_lock(&queuelock);
+  if (!workerrunning) {
+    pthread_mutex_unlock(&queuelock);
+    return;
+  }
+  workerstop=true;
+  pthread_cond_signal(&workready);
+  pthread_mutex_unlock(&queuelock);
+
+  pthread_join(worker,0);
+
+  pthread_mutex_lock(&queuelock);
+  workerrunning=false;
+  workerstop=false;
+  pthread_mutex_unlock(&queuelock);
+}
+
+// Marks a frame dirty and starts writing the shard back if it is
+// now over the high watermark
+// Called with the shard's lock held
+void BufferCache::MarkFrameDirty(CacheShard &s, BufferFrame *f)
 {
-  return disk->IsBlockAllocated(inblocknum);
+  s.SetDirty(f);
+
+  // the second level's copy is out of date now
+  if (l2) {
+    MutexHolder l(&l2lock);
+    l2->Invalidate(f->blocknum);
+  }
+
+  if (dirtyhigh<=0 || s.numdirty < dirtyhigh*s.numframes) {
+    return;
+  }
+
+  pthread_mutex_lock(&flushlock);
+  if (!flusherrunning) {
+    flusherstop=false;
+    if (pthread_create(&flusher,0,FlushWorker,this)) {
+      // no flusher; eviction will write the frames back instead
+      pthread_mutex_unlock(&flushlock);
+      return;
+    }
+    flusherrunning=true;
+  }
+  pthread_mutex_unlock(&flushlock);
+
+  FlushShard(s);
 }
 
+void *BufferCache::FlushWorker(void *cache)
+{
+  ((BufferCache *)cache)->FlushLoop();
+  return 0;
+}
 
-ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+//
+// Body of the background flusher thread
+//
+// It takes scheduled batches of write backs off the flush queue and
+// writes them, then lets go of their frames.
+//
+void BufferCache::FlushLoop()
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+  vector<DiskRequest *> done;
 
-  b = blockmap.find(inblocknum);
+  pthread_mutex_lock(&flushlock);
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, just update its lastaccessed and return it
-    outblock=(*b).second;
-    (*b).second.lastaccessed=curtime;
-    reads++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    // read it from disk
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum<<endl;
-      }
-    }
-    double reqtime;
-    int rc = disk->Read(inblocknum,
-			outblock,
-			reqtime);
-    curtime+=reqtime;
-    diskreads++;
-    if (rc!=ERROR_NOERROR) { 
-      return rc;
-    } else {
-      outblock.lastaccessed=curtime;
-      outblock.dirty=false;
-      blockmap[inblocknum]=outblock;
-      reads++;
-      return ERROR_NOERROR;
+  while (true) {
+    while (flushqueue.empty() && !flusherstop) {
+      pthread_cond_wait(&flushready,&flushlock);
+    }
+    if (flushqueue.empty()) {
+      // told to stop and nothing left to do
+      break;
+    }
+
+    DiskBatch *b=flushqueue.front();
+    SIZE_T     n=b->reqs.size();
+
+    flushqueue.pop_front();
+    pthread_mutex_unlock(&flushlock);
+
+    ERROR_T rc;
+
+    pthread_mutex_lock(&disklock);
+    rc=disk->Start(&b->ptrs[0],n);
+    done.clear();
+    if (rc==ERROR_NOERROR) {
+      rc=disk->Reap(done,n);
     }
+    pthread_mutex_unlock(&disklock);
+
+    // a batch comes from one shard
+    CacheShard &s=ShardFor(b->reqs[0].blocknum);
+
+    pthread_mutex_lock(&s.lock);
+    for (SIZE_T i=0;i<n;i++) {
+      BufferFrame *f=(BufferFrame *)b->reqs[i].tag;
+
+      f->pincount--;
+      f->writeback--;
+      s.diskwrites++;
+      s.diskwriterequests++;
+      if (rc!=ERROR_NOERROR || b->reqs[i].rc!=ERROR_NOERROR) {
+	// leave it for eviction or Detach to retry
+	s.SetDirty(f);
+      } else {
+	s.flushes++;
+      }
+    }
+    pthread_cond_broadcast(&s.iodone);
+    pthread_mutex_unlock(&s.lock);
+
+    pthread_mutex_lock(&flushlock);
+    flushpool.push_back(b);
+    flushbatchesdone++;
+    pthread_cond_broadcast(&flushdone);
   }
-} 
- 
-ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
+
+  pthread_mutex_unlock(&flushlock);
+}
+
+//
+// Writes back the longest dirty frames of one shard until it is
+// under the low watermark
+//
+// Up to FLUSH_BATCH frames at a time are copied out and marked
+// clean, scheduled in elevator order rather than age order, and
+// handed to the flusher to write.  The frames stay pinned (and
+// marked as being written back) meanwhile, so they can't be evicted
+// and read back from disk before the write lands.  If one is written
+// again in the mean time it goes back on the dirty list, and may go
+// out in a later batch too; writeback counts the batches, which the
+// flusher writes in order, so the newest copy lands last.
+// Called with the shard's lock held
+//
+void BufferCache::FlushShard(CacheShard &s)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(inblocknum);
+  SIZE_T passes=0;
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, so just replace the block
-    (*b).second=inblock;
-    (*b).second.lastaccessed=curtime;
-    (*b).second.dirty=true;
-    writes++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
-      }
+  // a frame can be redirtied while we write it, so bound the work
+  while (passes<s.numframes && s.numdirty>0 && s.numdirty > dirtylow*s.numframes) {
+    DiskBatch *b;
+
+    pthread_mutex_lock(&flushlock);
+    if (flushpool.empty()) {
+      b=new DiskBatch;
+      b->bufs.assign(FLUSH_BATCH,Block(disk->GetBlockSize()));
+    } else {
+      b=flushpool.back();
+      flushpool.pop_back();
     }
-    Block myblock=inblock;
-    myblock.lastaccessed=curtime;
-    myblock.dirty=true;
-    blockmap[inblocknum]=myblock;
-    writes++;
-    return ERROR_NOERROR;
+    pthread_mutex_unlock(&flushlock);
+
+    b->reqs.clear();
+    while (b->reqs.size()<FLUSH_BATCH && passes<s.numframes &&
+	   s.numdirty>0 && s.numdirty > dirtylow*s.numframes) {
+      BufferFrame *f=s.dirtytail;
+      DiskRequest  r;
+
+      b->bufs[b->reqs.size()]=f->block;
+      r.blocknum=f->blocknum;
+      r.block=&b->bufs[b->reqs.size()];
+      r.write=true;
+      r.tag=f;
+      b->reqs.push_back(r);
+      s.SetClean(f);
+      f->pincount++;
+      f->writeback++;
+      passes++;
+    }
+
+    DiskWriteBehind(*b);
+
+    MutexHolder fl(&flushlock);
+
+    flushqueue.push_back(b);
+    flushbatches++;
+    pthread_cond_signal(&flushready);
   }
 }
-  
-ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
+
+// Waits for the flusher to write what it has been given and exit
+void BufferCache::StopFlusher()
 {
-  // Not implemented yet
-  return ERROR_IMPLBUG;
+  pthread_mutex_lock(&flushlock);
+  if (!flusherrunning) {
+    pthread_mutex_unlock(&flushlock);
+    return;
+  }
+  flusherstop=true;
+  pthread_cond_signal(&flushready);
+  pthread_mutex_unlock(&flushlock);
+
+  pthread_join(flusher,0);
+
+  pthread_mutex_lock(&flushlock);
+  flusherrunning=false;
+  flusherstop=false;
+  pthread_mutex_unlock(&flushlock);
 }
-  
+
 ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(blocknum);
+  CacheShard &s=ShardFor(blocknum);
+  MutexHolder l(&s.lock);
+  BufferFrame *f;
 
-  if (b==blockmap.end()) { 
+  f = s.Lookup(blocknum);
+
+  // older copies being written back by the flusher must all land
+  // before ours, or one would overwrite it
+  while (f && (f->iopending || f->writeback)) {
+    WaitForIO(s);
+    f = s.Lookup(blocknum);
+  }
+
+  if (!f) { 
     return ERROR_NOERROR;
   } else {
-    if ((*b).second.dirty) { 
-      double reqtime;
-      int rc;
-      rc=disk->Write((*b).first,
-		     (*b).second,
-		     reqtime);
-      diskwrites++;
-      curtime+=reqtime;
-      if (rc!=ERROR_NOERROR) { 
+    if (f->block.dirty) { 
+      ERROR_T rc=WriteRun(vector<BufferFrame*>(1,f));
+      if (rc!=ERROR_NOERROR) {
 	return rc;
       }
     }
-    blockmap.erase(b);
+    if (f->pincount==0) { 
+      s.ReleaseFrame(f);
+    }
     return ERROR_NOERROR;
   }
 }
-  
+
+
+ERROR_T BufferCache::FlushAll()
+{
+  // an older copy the flusher is still writing must not land on top
+  // of ours
+  StopFlusher();
+  Settle(0);
+
+  LockAllShards();
+  ERROR_T rc=FlushAllLocked();
+  UnlockAllShards();
+  return rc;
+}
+
+// Writes back every dirty frame
+// Called with all shards locked and the flusher stopped
+ERROR_T BufferCache::FlushAllLocked()
+{
+  vector<BufferFrame*> dirtyframes;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    for (BufferFrame *f=shards[i].dirtyhead; f; f=f->dirtynext) {
+      dirtyframes.push_back(f);
+    }
+  }
+  return WriteBack(dirtyframes);
+}
+
+
+// Sums one of the per shard counters
+SIZE_T BufferCache::SumShards(SIZE_T CacheShard::*counter) const
+{
+  SIZE_T sum=0;
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    MutexHolder l(&(shards[i].lock));
+    sum+=shards[i].*counter;
+  }
+  return sum;
+}
+
+SIZE_T BufferCache::GetNumAllocs() const
+{
+  MutexHolder l(&disklock);
+
+  return allocs;
+}
+
+SIZE_T BufferCache::GetNumDeallocs() const
+{
+  MutexHolder l(&disklock);
+
+  return deallocs;
+}
+
+SIZE_T BufferCache::GetNumReads() const
+{
+  return SumShards(&CacheShard::reads);
+}
+
+SIZE_T BufferCache::GetNumWrites() const
+{
+  return SumShards(&CacheShard::writes);
+}
+
+SIZE_T BufferCache::GetNumDiskReads() const
+{
+  return SumShards(&CacheShard::diskreads);
+}
+
+SIZE_T BufferCache::GetNumDiskWrites() const
+{
+  return SumShards(&CacheShard::diskwrites);
+}
+
+SIZE_T BufferCache::GetNumDiskWriteRequests() const
+{
+  return SumShards(&CacheShard::diskwriterequests);
+}
+
+SIZE_T BufferCache::GetNumPrefetches() const
+{
+  return SumShards(&CacheShard::prefetches);
+}
+
+SIZE_T BufferCache::GetNumFlushes() const
+{
+  return SumShards(&CacheShard::flushes);
+}
+
+SIZE_T BufferCache::GetNumReadaheads() const
+{
+  return SumShards(&CacheShard::readaheads);
+}
+
+SIZE_T BufferCache::GetNumReadaheadHits() const
+{
+  return SumShards(&CacheShard::readaheadhits);
+}
+
+SIZE_T BufferCache::GetNumAdmissions() const
+{
+  return SumShards(&CacheShard::admitted);
+}
+
+SIZE_T BufferCache::GetNumRejections() const
+{
+  return SumShards(&CacheShard::rejected);
+}
+
+SIZE_T BufferCache::GetNumSecondLevelHits() const
+{
+  MutexHolder l(&l2lock);
+
+  return l2 ? l2->GetNumHits() : 0;
+}
+
+SIZE_T BufferCache::GetNumSecondLevelWrites() const
+{
+  MutexHolder l(&l2lock);
+
+  return l2 ? l2->GetNumWrites() : 0;
+}
+
+
 ostream & BufferCache::Print(ostream &os) const
 {
+  SIZE_T reads=0, writes=0, diskreads=0, diskwrites=0, prefetches=0, flushes=0;
+  SIZE_T diskwriterequests=0;
+  SIZE_T readaheads=0, readaheadhits=0, protectedframes=0;
+  SIZE_T admitted=0, rejected=0;
+  bool   admission=false;
+  vector<BufferFrame*> resident;
+
+  LockAllShards();
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    reads+=shards[i].reads;
+    writes+=shards[i].writes;
+    diskreads+=shards[i].diskreads;
+    diskwrites+=shards[i].diskwrites;
+    diskwriterequests+=shards[i].diskwriterequests;
+    prefetches+=shards[i].prefetches;
+    flushes+=shards[i].flushes;
+    readaheads+=shards[i].readaheads;
+    readaheadhits+=shards[i].readaheadhits;
+    protectedframes+=shards[i].protring.size;
+    admitted+=shards[i].admitted;
+    rejected+=shards[i].rejected;
+    admission=shards[i].admission;
+  }
+
+  SIZE_T arenasize=0;
+  for (SIZE_T i=0;i<extents.size();i++) {
+    arenasize+=extents[i].arenasize;
+  }
+
   os << "BufferCache(cachesize="<<cachesize
      << ", blocksize="<<GetBlockSize()
-     << ", curtime="<<curtime
-     << ", allocs="<<allocs
-     << ", deallocs="<<deallocs
+     << ", arenasize="<<arenasize
+     << ", curtime="<<Now()
+     << ", allocs="<<GetNumAllocs()
+     << ", deallocs="<<GetNumDeallocs()
      << ", reads="<<reads
      << ", writes="<<writes
      << ", diskreads="<<diskreads
      << ", diskwrites="<<diskwrites
-     << ", blocks = {";
+     << ", diskwriterequests="<<diskwriterequests
+     << ", prefetches="<<prefetches
+     << ", flushes="<<flushes
+     << ", readaheads="<<readaheads
+     << ", readaheadhits="<<readaheadhits
+     << ", protected="<<protectedframes<<"/"<<protectsize;
+  if (admission) {
+    os << ", admission=tinylfu(admitted="<<admitted<<", rejected="<<rejected<<")";
+  }
+  if (warmrestart) {
+    os << ", preloaded="<<preloaded;
+  }
+  if (l2) {
+    MutexHolder l(&l2lock);
+    os << ", secondlevel="<<*l2;
+  }
+  os << ", shards="<<numshards
+     << ", policy=";
+  if (numshards==1) {
+    os << *(shards[0].policies[0]);
+  } else {
+    os << shards[0].policies[0]->GetName();
+  }
+  if (clients.size()>1) {
+    os << ", clients={";
+    for (SIZE_T c=1;c<clients.size();c++) {
+      SIZE_T n=0;
+      for (SIZE_T i=0;i<numshards;i++) {
+	n+=shards[i].clientresident[c];
+      }
+      os << (c>1 ? ", " : "") << c << ":(first="<<clients[c].first
+	 << ", numblocks="<<clients[c].numblocks
+	 << ", quota="<<clients[c].quota<<", resident="<<n<<")";
+    }
+    os << "}";
+  }
+  os << ", blocks = {";
+
+  for (SIZE_T i=0;i<numshards;i++) {
+    for (SIZE_T j=0;j<shards[i].frames.size();j++) { 
+      if (shards[i].frames[j]->inuse) { 
+	resident.push_back(shards[i].frames[j]);
+      }
+    }
+  }
+  sort(resident.begin(),resident.end(),frame_blocknum_lessthan);
 
-  
-  for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b=blockmap.begin(); 
-       b!=blockmap.end(); 
+  for (vector<BufferFrame*>::const_iterator b=resident.begin(); 
+       b!=resident.end(); 
        ++b) {
-    if (b!=blockmap.begin()) { 
+    if (b!=resident.begin()) { 
       os << ", ";
     }
-    os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+    os << (*b)->blocknum << ((*b)->block.dirty ? "(dirty)" : "");
+  }
+  os << "}, disk="<<*disk;
+
+  UnlockAllShards();
+
+  if (mrc) { 
+    os << ", missratiocurve=" << endl;
+    PrintMissRatioCurve(os);
+  }
+  os << ")";
+
+  return os;
+}
+
+ostream & BufferCache::PrintMissRatioCurve(ostream &os) const
+{
+  // before mrclock, which is taken after the shard locks
+  SIZE_T measured=SumShards(&CacheShard::diskreads);
+
+  MutexHolder l(&mrclock);
+
+  if (!mrc) { 
+    return os;
+  }
+
+  double total, avgread, fixed;
+  {
+    MutexHolder t(&timelock);
+    total=curtime;
+    avgread = timedreads>0 ? readtime/timedreads : 0;
+    fixed=curtime-readtime;
+  }
+  // powers of two up to the size of the device, and our own size
+  vector<SIZE_T> sizes;
+  SIZE_T         numblocks=disk->GetNumBlocks();
+
+  for (SIZE_T c=1; c<numblocks; c*=2) { 
+    sizes.push_back(c);
+  }
+  sizes.push_back(numblocks);
+  sizes.push_back(cachesize);
+  sort(sizes.begin(),sizes.end());
+  sizes.erase(unique(sizes.begin(),sizes.end()),sizes.end());
+
+  os << "  sampling " << mrc->GetRate()*100 << "% of blocks, "
+     << mrc->GetNumReferences() << " references, "
+     << mrc->GetNumReads() << " reads, "
+     << avgread << " per disk read" << endl;
+  os << "  cachesize  hitratio  diskreads        time" << endl;
+  for (vector<SIZE_T>::const_iterator c=sizes.begin(); c!=sizes.end(); ++c) { 
+    double reads=mrc->GetNumReads()*(1-mrc->ReadHitRatio(*c));
+    char   line[80];
+    snprintf(line,sizeof(line),"%c %9u  %8.4f  %9.0f  %10.2f",
+	     *c==cachesize ? '*' : ' ',
+	     *c, mrc->HitRatio(*c), reads, fixed+reads*avgread);
+    os << line << endl;
   }
-  os << "}, disk="<<*disk<<")";
-  
+  // what we actually got, for comparison
+  os << "  (measured: cachesize " << cachesize << ", "
+     << measured << " disk reads, time " << total << ")" << endl;
   return os;
 }
-  
+
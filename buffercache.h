@@ -2,39 +2,474 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <vector>
+#include <deque>
+#include <pthread.h>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "cachepolicy.h"
+#include "missratio.h"
+#include "secondlevel.h"
+#include "scheduler.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-  bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-    return s1<s2;
-  }
+//
+// How a block is about to be used
+//
+// BUFFER_ACCESS_SCAN is for one pass traversals that won't come
+// back to the block soon.  Such reads don't count as a use of a
+// resident block.  A block they bring in goes on a small ring of
+// scan frames, which are evicted before anything else, instead of
+// into the replacement policy.  A normal access to a scan frame
+// moves it into the policy.
+//
+// BUFFER_ACCESS_PROTECT is for blocks every request goes through,
+// such as an index's superblock, root and interior nodes.  They
+// are kept in a protected tier of the shard, which eviction leaves
+// alone; when the tier is full its least recently used frame moves
+// down into the policy.
+//
+enum BufferAccessHint {BUFFER_ACCESS_NORMAL, BUFFER_ACCESS_SCAN,
+		       BUFFER_ACCESS_PROTECT};
+
+
+//
+// A cache frame: a resident block plus its links in the
+// replacement policy's lists and in the block number hash index
+//
+struct BufferFrame {
+  SIZE_T       blocknum;
+  Block        block;
+  BufferFrame *prev;      // policy list links
+  BufferFrame *next;      // (next also links the free list)
+  BufferFrame *hashnext;  // next frame in the same hash bucket
+  SIZE_T       pincount;  // pinned frames are never evicted
+  bool         iopending; // a prefetch is still filling the frame
+  double       readytime; // simulated time the frame's data arrived
+  bool         inuse;     // resident, as opposed to on the free list
+  SIZE_T       writeback; // flusher batches writing the frame out
+  BufferFrame *dirtyprev; // dirty list links
+  BufferFrame *dirtynext;
+  bool         ondirtylist;
+  bool         scan;      // on the shard's scan ring, not in the policy
+  bool         readahead; // read ahead and not used yet
+  bool         protect;   // in the shard's protected tier, not in the policy
+  bool         windowed;  // in the shard's admission window, not in the policy
+  SIZE_T       client;    // whose policy holds the frame (see CacheClient)
+
+  // replacement policy state
+  int           queue;        // which of the policy's lists
+  bool          referenced;   // CLOCK reference bit
+  SIZE_T        heappos;      // position in LRU-2's heap
+  unsigned long hist[2];      // LRU-2 reference history
+
+  BufferFrame() : blocknum(0), prev(0), next(0), hashnext(0), pincount(0),
+		  iopending(false), readytime(0), inuse(false), writeback(0),
+		  dirtyprev(0), dirtynext(0), ondirtylist(false), scan(false),
+		  readahead(false), protect(false), windowed(false), client(0),
+		  queue(0), referenced(false), heappos(0) { hist[0]=hist[1]=0; }
 };
 
 
 //
-// LRU block cache with single step prefetch
+// A client of a shared cache, such as one of several indexes
+//
+// The client owns blocks first to first+numblocks-1.  quota frames
+// are kept for its blocks; past that it borrows whatever frames the
+// other clients leave idle, and gives them back first when they
+// want them.  Blocks no client owns belong to client 0, which has
+// no quota.
+//
+struct CacheClient {
+  SIZE_T first;
+  SIZE_T numblocks;
+  SIZE_T quota;
+
+  CacheClient(const SIZE_T f=0, const SIZE_T n=0, const SIZE_T q=0) :
+    first(f), numblocks(n), quota(q) {}
+};
+
+
+//
+// A batch of frames allocated together, with the arena holding
+// their data.  Frames never move once allocated, since pinners hold
+// pointers into them.
+//
+struct FrameExtent {
+  BufferFrame *frames;
+  SIZE_T       numframes;
+  BYTE_T      *arena;
+  SIZE_T       arenasize;
+};
+
+
+//
+// One partition of the cache
+//
+// Each shard owns some of the frames, its own hash index,
+// replacement policy and statistics, and is guarded by its own
+// lock.  Blocks are assigned to shards by block number, so threads
+// working on different blocks rarely contend.  With clients, the
+// shard keeps a policy for each and splits their quotas in
+// proportion to its size.
+//
+struct CacheShard {
+  vector<BufferFrame*> frames;     // every frame this shard owns
+  SIZE_T               numframes;  // how many of them may be resident
+  vector<BufferFrame*> buckets;
+  SIZE_T               bucketmask;
+  CachePolicyType      policytype;
+  const vector<CacheClient> *clients;
+  vector<CachePolicy*> policies;   // one per client
+  vector<SIZE_T>       clientresident;
+  vector<SIZE_T>       clientshare;
+  vector<bool>         tried;      // scratch for Victim
+  FrameList            scanring;   // frames brought in by scans, newest first
+  SIZE_T               scanmax;    // scans recycle their own frames past this
+  FrameList            protring;   // the protected tier, most recent first
+  SIZE_T               protmax;
+  bool                 admission;  // TinyLFU admission is on
+  FrameList            window;     // new frames waiting for admission, newest first
+  SIZE_T               windowmax;
+  FrequencySketch      sketch;     // recent references, for admission
+  BufferFrame         *freeframes; // unused frames, linked through next
+  SIZE_T               numresident;
+  BufferFrame         *dirtyhead;  // dirty frames, most recently dirtied first
+  BufferFrame         *dirtytail;
+  SIZE_T               numdirty;
+  SIZE_T reads, writes, diskreads, diskwrites, prefetches, flushes;
+  SIZE_T diskwriterequests;
+  SIZE_T readaheads, readaheadhits;
+  SIZE_T admitted, rejected;
+
+  pthread_mutex_t lock;            // protects everything above
+  pthread_cond_t  iodone;          // a read into one of our frames finished
+
+  CacheShard();
+  ~CacheShard();
+
+  void         Init(const CachePolicyType policy,
+		    const vector<CacheClient> *clients);
+  // Takes on n more frames, all free
+  void         AddFrames(BufferFrame *f, const SIZE_T n);
+  // Lets numframes be resident and resizes the index and policies
+  // to match; the caller evicts any excess
+  void         SetSize(const SIZE_T numframes);
+  // Adds a policy for the newest client and moves its resident
+  // frames over to it
+  void         AddClient();
+  SIZE_T       ClientFor(const SIZE_T blocknum) const;
+  SIZE_T       Hash(const SIZE_T blocknum) const;
+  BufferFrame *Lookup(const SIZE_T blocknum) const;
+  void         HashInsert(BufferFrame *f);
+  void         HashRemove(BufferFrame *f);
+  // Takes a free frame and makes it resident for blocknum
+  BufferFrame *AllocateFrame(const SIZE_T blocknum, const double now,
+			     const bool scan=false);
+  void         ReleaseFrame(BufferFrame *f);
+  // Frame to evict to make room for incoming, or 0 if all are pinned
+  BufferFrame *Victim(const SIZE_T incoming, const bool scan);
+  BufferFrame *PolicyVictim(const SIZE_T incoming);
+  BufferFrame *AdmissionVictim(const SIZE_T incoming);
+  // Puts a new frame in the policy, or in the window if admission
+  // is on
+  void         Admit(BufferFrame *f);
+  // Counts a demand reference in the sketch
+  void         Record(const SIZE_T blocknum);
+  // Turns admission on or off; off hands the window to the policy
+  void         SetAdmission(const bool on);
+  // Hands a frame on the scan ring over to the policy
+  void         Promote(BufferFrame *f);
+  // Moves a frame to the front of the protected tier, and sets the
+  // tier's size, moving whatever no longer fits into the policy
+  void         Protect(BufferFrame *f);
+  void         SetProtected(const SIZE_T n);
+  void         Reset();
+  // Sets or clears the frame's dirty bit and keeps the dirty list
+  // in step; always use these rather than block.dirty directly
+  void         SetDirty(BufferFrame *f);
+  void         SetClean(BufferFrame *f);
+  // Is a read or a write back of one of our frames in progress?
+  bool         HasPendingIO() const;
+};
+
+
+//
+// A sequential stream of reads being tracked for readahead
+//
+struct ReadaheadStream {
+  SIZE_T        next;      // the block that would continue the stream
+  SIZE_T        window;    // blocks to read in its next request
+  SIZE_T        start;     // the last blocks read ahead for it
+  SIZE_T        issued;
+  SIZE_T        used;      // how many of those have been read since
+  unsigned long lastuse;
+
+  ReadaheadStream() : next(0), window(0), start(0), issued(0), used(0), lastuse(0) {}
+};
+
+
+//
+// A batch of background reads or writes.  Its simulated times are
+// decided when it is scheduled; the thread it is handed to only
+// moves the data.
+//
+struct DiskBatch {
+  vector<DiskRequest>   reqs;
+  vector<DiskRequest *> ptrs;   // the order they were scheduled in
+  vector<Block>         bufs;   // copies of the frames a flush writes
+};
+
+
+//
+// Block cache with single step prefetch
 //
 // Write Back
 // Write Allocate
+//
+// Resident blocks live in a set of frames.  A hash index maps
+// block numbers to frames and a replacement policy, chosen when the
+// cache is constructed, picks victims.  The default is LRU; CLOCK,
+// 2Q, ARC and LRU-2 are also available (see cachepolicy.h).
+//
+// The cache is safe to share between threads.  Frames are split
+// into shards by block number (see CacheShard) and there is no lock
+// over the whole cache on the hit or miss paths.  A miss marks its
+// frame I/O pending and reads the block with the shard unlocked;
+// other threads wanting the same block wait on the frame, so it is
+// read only once.  Statistics are kept per shard and summed when
+// they are asked for.
+//
+// Prefetches wait in an elevator until the disk is next wanted: by
+// a demand request, which queues behind them, or by touching a
+// prefetched block.  They are then scheduled on the caller's
+// simulated clock, each as if it had gone to the disk when it was
+// issued, which decides when each block arrives and where it leaves
+// the head.  A background worker thread reads the data while the
+// caller carries on.  In simulated time the disk is busy until
+// diskfreetime, and touching a prefetched block before it has
+// arrived waits for it.  A miss first lets the worker finish, so
+// which frames it still has pinned, and so what can be evicted,
+// never depends on how fast the thread ran.  With
+// SetDiskQueueDepth above 1 the disk holds several of a batch of
+// prefetches or write backs at once and serves the nearest first,
+// so a block is ready when its own read completes rather than after
+// all those issued ahead of it.
+//
+// Each shard keeps its dirty frames on a list, so writing them all
+// back costs O(dirty).  Write backs are sorted by block number and
+// adjacent blocks go to the disk as one request; an eviction takes
+// the dirty neighbours of its victim along.  The disk write count is
+// still of blocks; GetNumDiskWriteRequests counts the requests.
+// Optionally a background flusher writes dirty frames ahead of
+// eviction: when a write takes the dirty fraction of a shard to the
+// high watermark, its longest dirty frames are written back until
+// it is down to the low watermark.  Like prefetches, these writes
+// occupy the simulated disk but not the caller.  They are scheduled
+// there and then, on the caller's clock, and the flusher thread
+// only moves the data.
+//
+// The frames' data lives in one page aligned arena, allocated when
+// the cache is built, with each frame on its own cache lines.  The
+// cache also reserves a few buffers in Block's buffer pool, so in
+// steady state reading, writing and evicting allocate no memory.
+//
+// SetCacheSize resizes the cache while it is in use.  Growing adds
+// an extent of frames with an arena of its own.  Shrinking evicts
+// down to the new size, and frees the newest extents once nothing
+// in them is pinned.  Several clients sharing the cache can each be
+// given a quota (see CacheClient).
+//
+// Blocks read with BUFFER_ACCESS_PROTECT, or handed to ProtectBlock,
+// sit in a protected tier of SetProtectedSize frames that eviction
+// only touches when nothing else is left.
+//
+// With SetAdmission, new blocks go through a small window in front
+// of the policy and only stay once they have been used more often
+// than what the policy would evict for them (W-TinyLFU, Einziger,
+// Friedman and Manes).  Blocks used once then no more don't push
+// out the ones that keep being used.
+//
+// Misses that continue a sequential stream of reads are served by
+// one request for a window of blocks starting with the one wanted.
+// The window starts small and doubles while all of what was read
+// ahead gets used, and halves when less than half of it is, up to a
+// maximum set by SetReadahead.  It ends before the first block that
+// isn't allocated.  Readahead is off unless SetReadahead turns it on.
+//
+// With SetWarmRestart, Detach saves the block numbers of the
+// working set, most recently used first, next to the disk's files,
+// and Attach reads them back in before the first request.  The
+// blocks are sorted and adjacent ones read together, so a warm
+// start costs a sweep across the disk rather than a random read per
+// block.
+//
+// SetSecondLevel puts a victim cache on a second, faster disk
+// behind this one (see SecondLevelCache).  Blocks evicted clean are
+// copied there, and misses look there before the primary disk.  In
+// simulated time the two devices work independently: copying out
+// keeps the fast device busy but not the caller, and a read from it
+// waits only for the fast device.
+//
+// SetDiskIOMode chooses how the disks reach their files (see
+// DiskIOMode); it changes wall clock time only, never simulated time.
+//
+// Optionally the cache estimates its miss ratio curve as it runs
+// (see missratio.h), and Print reports the predicted hit ratio,
+// disk reads and total time for a range of cache sizes.
+//
 class BufferCache {
  private:
   DiskSystem *disk;
   SIZE_T cachesize;
-  map<SIZE_T, Block, cache_compare_lessthan> blockmap;
+  vector<FrameExtent>  extents;    // the first is never freed
+  SIZE_T               numframes;  // in all the extents
+  vector<CacheClient>  clients;    // changed with all shards locked
+  SIZE_T               protectsize; // frames in the protected tiers
+  CacheShard          *shards;
+  SIZE_T               numshards;
+  SIZE_T allocs, deallocs;      // protected by disklock
+
+  // simulated time, protected by timelock
   double curtime;
-  SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+  double diskfreetime;
+  double readtime;              // time spent in demand reads
+  SIZE_T timedreads;
+
+  MissRatioCurve *mrc;          // zero unless enabled
+  mutable pthread_mutex_t mrclock;
+
+  // readahead streams, protected by ralock
+  SIZE_T                  readaheadmax;
+  vector<ReadaheadStream> streams;
+  unsigned long           ratick;
+  pthread_mutex_t         ralock;
+  vector<BYTE_T *>        rabuf;        // frames of a readahead, under disklock
+
+  // second level cache, zero unless enabled; its simulated time is
+  // protected by timelock
+  SecondLevelCache       *l2;
+  double                  l2freetime;
+  mutable pthread_mutex_t l2lock;
+
+  // warm restart: remember the working set in filestem.warm
+  bool                    warmrestart;
+  bool                    attached;     // between Attach and Detach
+  SIZE_T                  preloaded;    // blocks the last Attach read in
+
+  DiskIOMode              diskiomode;   // for the disk and l2's
+
+  // Lock order: shard locks (in index order), then disklock,
+  // then timelock.  queuelock and flushlock are taken after a shard
+  // lock or disklock, or alone; mrclock and ralock after a shard
+  // lock or alone.  l2lock is taken after a shard lock or alone, and
+  // before timelock.
+  mutable pthread_mutex_t timelock;
+  mutable pthread_mutex_t disklock;  // serializes access to the disk
+  pthread_mutex_t queuelock;    // protects the prefetch queue and worker
+  pthread_cond_t  workready;    // the prefetch queue is non-empty
+  pthread_t       worker;
+  bool            workerrunning;
+  bool            workerstop;
+  deque<DiskBatch *> prefetchqueue;  // scheduled, for the worker
+  vector<DiskBatch *> prefetchpool;  // and done with
+  SIZE_T          prefetchbatches, prefetchbatchesdone;
+  pthread_cond_t  workdone;     // the worker finished a batch
+
+  // prefetches waiting to be scheduled, and batches scheduled but
+  // not yet handed to the worker, protected by disklock
+  DiskScheduler       prefetchsched;
+  vector<ScheduledIO> prefetchnext;
+  vector<DiskBatch *> prefetchheld;
+
+  // data of the frames of a run being written, protected by disklock
+  vector<BYTE_T *> runbuf;
+
+  // clean gaps of up to this many resident blocks are rewritten to
+  // join two runs of dirty blocks into one request
+  SIZE_T          writebackgap;
+
+  // dirty watermarks as fractions of a shard; zero means no flusher
+  double          dirtyhigh, dirtylow;
+  pthread_mutex_t flushlock;    // protects the flusher state
+  pthread_cond_t  flushready;   // the flush queue is non-empty
+  pthread_t       flusher;
+  bool            flusherrunning;
+  bool            flusherstop;
+  deque<DiskBatch *>  flushqueue;  // scheduled, for the flusher
+  vector<DiskBatch *> flushpool;   // and done with
+  SIZE_T          flushbatches, flushbatchesdone;
+  pthread_cond_t  flushdone;    // the flusher finished a batch
+
+  // orders write backs, protected by disklock
+  DiskScheduler       flushsched;
+  vector<ScheduledIO> flushnext;
+
+  CacheShard  &ShardFor(const SIZE_T blocknum);
+  SIZE_T       ShardSize(const SIZE_T i, const SIZE_T size) const;
+  ERROR_T      Grow(const SIZE_T size);
+  ERROR_T      Shrink();
+  bool         ReleaseExtent();
+  void         SplitQuotas();
+  void         SplitProtected();
+  void         LockAllShards() const;
+  void         UnlockAllShards() const;
+  double       Now() const;
+  void         Reference(const SIZE_T blocknum, const bool read);
+  void         Touch(CacheShard &s, BufferFrame *f);
+  ERROR_T      FetchFrame(CacheShard &s, const SIZE_T blocknum, BufferFrame *&f,
+			  const BufferAccessHint hint);
+  ERROR_T      DiskRead(const SIZE_T blocknum, Block &block);
+  ERROR_T      DiskRead(BufferFrame **run, const SIZE_T n);
+  ERROR_T      SecondLevelRead(const SIZE_T blocknum, Block &block);
+  void         Spill(const BufferFrame *f);
+  SIZE_T       ReadaheadWindow(const SIZE_T blocknum);
+  void         ReadaheadIssued(const SIZE_T blocknum, const SIZE_T n);
+  void         ReadaheadHit(const SIZE_T blocknum);
+  SIZE_T       ReadAhead(CacheShard &s, BufferFrame **run, const SIZE_T n,
+			 const bool scan);
+  void         ResetReadahead();
+  string       WarmFileName() const;
+  ERROR_T      SaveWorkingSet();
+  ERROR_T      LoadWorkingSet();
+  SIZE_T       SumShards(SIZE_T CacheShard::*counter) const;
+  ERROR_T      DiskWrite(const vector<BufferFrame*> &run);
+  void         DiskWriteBehind(DiskBatch &b);
+  ERROR_T      WriteRun(const vector<BufferFrame*> &run);
+  ERROR_T      WriteBack(vector<BufferFrame*> &dirty);
+  ERROR_T      WriteCluster(CacheShard &s, BufferFrame *victim);
+  ERROR_T      FlushAllLocked();
+  void         SchedulePrefetches();
+  void         StartPrefetches();
+  bool         Settle(CacheShard *s);
+  void         WaitForIO(CacheShard &s);
+  void         StopWorker();
+  static void *PrefetchWorker(void *cache);
+  void         PrefetchLoop();
+  void         MarkFrameDirty(CacheShard &s, BufferFrame *f);
+  void         StopFlusher();
+  static void *FlushWorker(void *cache);
+  void         FlushLoop();
+  void         FlushShard(CacheShard &s);
  protected:
-  ERROR_T CheckDeleteOldest();
+  // Makes room for incoming if its shard is full
+  // Called with the shard's lock held
+  ERROR_T CheckDeleteOldest(CacheShard &s, const SIZE_T incoming,
+			    const bool scan=false);
+  // Evicts one frame, writing it back first if it is dirty
+  // returns ERROR_NOSPACE if every frame is pinned
+  ERROR_T Evict(CacheShard &s, const SIZE_T incoming, const bool scan);
  public:
   // Cache size is in number of blocks
+  // The frames are split evenly over numshards shards
+  // (at most one per frame)
   BufferCache(DiskSystem *disk,
-	      const SIZE_T cachesize);
+	      const SIZE_T cachesize,
+	      const CachePolicyType policy=CACHE_POLICY_LRU,
+	      const SIZE_T numshards=1);
   BufferCache() { throw 0; }
   BufferCache(const BufferCache &rhs) { throw 0; } 
   BufferCache & operator=(const BufferCache &rhs) { throw 0; return *this; } 
@@ -47,12 +482,86 @@ class BufferCache {
 
   // Number of blocks in the cache
   SIZE_T GetCacheSize() const;
+  // Grows or shrinks the cache, which may be in use.  Shrinking
+  // writes back and evicts down to the new size; frames that are
+  // pinned are given up as they are unpinned.
+  // returns ERROR_NOERROR, ERROR_SIZE if the cache would be smaller
+  // than its shards or its clients' quotas, or ERROR_NOMEM
+  ERROR_T SetCacheSize(const SIZE_T cachesize);
+
+  // Registers a client owning blocks first to first+numblocks-1
+  // with a quota of frames (see CacheClient), and returns its
+  // number, counting from 1
+  // returns ERROR_NOERROR, ERROR_CONFLICT if the blocks overlap
+  // another client's, or ERROR_SIZE if the quotas would add up to
+  // more than the cache
+  ERROR_T AddClient(const SIZE_T first, const SIZE_T numblocks,
+		    const SIZE_T quota, SIZE_T &client);
+  // Size of the protected tier (see BUFFER_ACCESS_PROTECT), split
+  // over the shards; at most half the cache, and 0, the default,
+  // turns it off
+  void    SetProtectedSize(const SIZE_T n);
+  // Moves a resident block into the protected tier, for callers
+  // that only know to protect it once they have read it
+  // returns ERROR_NOERROR or ERROR_NONEXISTENT
+  ERROR_T ProtectBlock(const SIZE_T blocknum);
+
+  // Turns the TinyLFU admission filter on or off (default off)
+  void    SetAdmission(const bool on);
+  // Adds a second level cache on the disk made by makedisk with the
+  // given filestem, which must have the same block size.  Call it
+  // before the cache is shared between threads.
+  // returns ERROR_NOERROR, ERROR_NOFILE or ERROR_WRONGSIZEBLOCK
+  ERROR_T SetSecondLevel(const string &filestem);
+  // Switches the disk, and the second level's, to another I/O mode
+  // returns ERROR_NOERROR or the disk's error
+  ERROR_T SetDiskIOMode(const DiskIOMode mode);
+  // Sets how many requests the disk can hold and reorder at once
+  // (see DiskSystem::SetQueueDepth; default 1)
+  void    SetDiskQueueDepth(const SIZE_T depth);
+  // Saves the working set at Detach and reloads it at Attach, in
+  // the disk's filestem.warm (default off)
+  void    SetWarmRestart(const bool on);
+  // Number of blocks the last Attach read in from the saved
+  // working set
+  SIZE_T  GetNumPreloaded() const;
+
+  // Moves a client's quota, for instance from a cold index to a hot one
+  // returns ERROR_NOERROR, ERROR_NONEXISTENT or ERROR_SIZE
+  ERROR_T SetClientQuota(const SIZE_T client, const SIZE_T quota);
+  // Number of frames holding a client's blocks
+  SIZE_T  GetClientResident(const SIZE_T client) const;
+
+  // Number of shards the cache is split into
+  SIZE_T GetNumShards() const;
   // Number of bytes per block
   SIZE_T GetBlockSize() const;
   // Number of blocks in the underlying device
   SIZE_T GetNumBlocks() const;
   // Current time in the simulation (starts at zero)
   double GetCurrentTime() const;
+  // Name of the replacement policy
+  const char *GetPolicyName() const;
+  // Bytes of block data held by the frames
+  SIZE_T GetArenaSize() const;
+
+  // Starts background write back of dirty blocks once more than
+  // high of a shard is dirty, stopping when it is down to low
+  // (both fractions, 0<=low<high<=1).  high=0 turns it off, which
+  // is the default.
+  // returns ERROR_NOERROR or ERROR_BADCONFIG
+  ERROR_T SetDirtyWatermarks(const double high, const double low);
+  // Lets write back rewrite up to gap clean, resident blocks to
+  // merge two runs of dirty blocks into one request (default 0)
+  void    SetWritebackGap(const SIZE_T gap);
+  // Largest readahead window in blocks (default 0, off; at most
+  // 128).  Call it before the cache is shared between threads.
+  void    SetReadahead(const SIZE_T max);
+  // Starts estimating the miss ratio curve, tracking the given
+  // fraction of the blocks (0<rate<=1); rate=0 stops.  Call it
+  // before the cache is shared between threads.
+  // returns ERROR_NOERROR or ERROR_BADCONFIG
+  ERROR_T EnableMissRatioCurve(const double rate);
 
   // outblocknum is the number of the block that we just allocated
   // if the error return is nonzero
@@ -61,33 +570,90 @@ class BufferCache {
   ERROR_T NotifyDeallocateBlock(const SIZE_T inblocknum);
   // check to see if we think the block was allocated
   bool  IsBlockAllocated(const SIZE_T inblocknum);
+  // Allocates num blocks in a row, at or after hint if it can
+  // returns ERROR_NOERROR with outfirst set, or ERROR_NOSPACE
+  ERROR_T AllocateBlocks(const SIZE_T num, const SIZE_T hint, SIZE_T &outfirst);
+  SIZE_T  GetNumFreeBlocks() const;
   
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK or other nonzero error codes
-  ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock);
+  ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock,
+		    const BufferAccessHint hint=BUFFER_ACCESS_NORMAL);
   
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK
-  // ERROR_WRONGSIZEBLOCK or other nonzero error codes
+  // ERROR_WRONGSIZEBLOCK (inblock must be GetBlockSize() long)
+  // or other nonzero error codes
   ERROR_T WriteBlock(const SIZE_T inblocknum, const Block &inblock);
+
+  // Zero-copy access to a cached block
+  //
+  // PinBlock reads the block into the cache if needed and returns
+  // a pointer to the cached copy itself.  The frame stays resident
+  // and the pointer stays valid until the matching UnpinBlock.
+  // Changes made through the pointer must be reported with MarkDirty
+  // (or UnpinBlock(blocknum,true)) so they are written back.
+  // Pins nest; each PinBlock needs its own UnpinBlock.
+  // A pin keeps the frame resident but is not a latch: threads
+  // that share a block must coordinate changes to its contents.
+  //
+  // returns one of ERROR_NOERROR (zero)
+  // ERROR_NOSPACE if every frame is pinned
+  // ERROR_NONEXISTENT if the block is not pinned (Unpin/MarkDirty)
+  // or other nonzero error codes
+  ERROR_T PinBlock(const SIZE_T blocknum, Block *&frame,
+		   const BufferAccessHint hint=BUFFER_ACCESS_NORMAL);
+  ERROR_T UnpinBlock(const SIZE_T blocknum, const bool dirty=false);
+  ERROR_T MarkDirty(const SIZE_T blocknum);
   
   // Request that a block be read into the cache
   // This returns immediately.
   // ERROR_NOFETCH means that there is no room currently
   // to prefetch the block and it was not prefetched.
-  ERROR_T PrefetchBlock (const SIZE_T blocknum);
+  // A prefetch only takes a free frame or a clean, unpinned one;
+  // it never makes the caller wait for a write back.
+  ERROR_T PrefetchBlock (const SIZE_T blocknum,
+			 const BufferAccessHint hint=BUFFER_ACCESS_NORMAL);
   
   // Request that a block be flushed to disk
   // Note that this blocks until the block is finished.
+  // A pinned block is written back but stays in the cache.
   ERROR_T FlushBlock(const SIZE_T blocknum);
+
+  // Checkpoint: writes every dirty block back, in as few requests
+  // as possible, and keeps them all cached
+  ERROR_T FlushAll();
   
  
-  SIZE_T GetNumAllocs() const { return allocs; }
-  SIZE_T GetNumDeallocs() const { return deallocs; }
-  SIZE_T GetNumReads() const { return reads;}
-  SIZE_T GetNumWrites() const { return writes;}
-  SIZE_T GetNumDiskReads() const { return diskreads;}
-  SIZE_T GetNumDiskWrites() const { return diskwrites;}
+  SIZE_T GetNumAllocs() const;
+  SIZE_T GetNumDeallocs() const;
+  SIZE_T GetNumReads() const;
+  SIZE_T GetNumWrites() const;
+  SIZE_T GetNumDiskReads() const;
+  // Number of blocks written to the disk, and of requests that
+  // wrote them
+  SIZE_T GetNumDiskWrites() const;
+  SIZE_T GetNumDiskWriteRequests() const;
+  SIZE_T GetNumPrefetches() const;
+  // Number of blocks the background flusher wrote back
+  SIZE_T GetNumFlushes() const;
+  // Number of blocks read ahead, and of those later read
+  SIZE_T GetNumReadaheads() const;
+  SIZE_T GetNumReadaheadHits() const;
+  // Number of blocks the admission filter let into the policy, and
+  // turned away
+  SIZE_T GetNumAdmissions() const;
+  SIZE_T GetNumRejections() const;
+  // Number of misses the second level cache served, and of blocks
+  // copied to it
+  SIZE_T GetNumSecondLevelHits() const;
+  SIZE_T GetNumSecondLevelWrites() const;
+
+  // Table of predicted hit ratio, disk reads and total time for
+  // cache sizes from one block up to the size of the device.  Disk
+  // reads are charged at their average cost so far; all other time
+  // is assumed not to depend on the cache size.
+  ostream & PrintMissRatioCurve(ostream &os) const;
 
   ostream & Print(ostream &os) const;
   
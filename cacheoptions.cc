@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cacheoptions.h"
+
+
+int ParseCacheOptions(int argc, char **argv, CacheOptions &opts)
+{
+  int c;
+
+  // stop at the first positional argument
+  while ((c=getopt(argc,argv,"+p:s:d:g:m:r:t:awl:i:q:"))!=-1) {
+    switch (c) {
+    case 'p':
+      if (CachePolicy::Parse(optarg,opts.policy)!=ERROR_NOERROR) {
+	cerr << "unknown cache policy "<<optarg<<endl;
+	return -1;
+      }
+      break;
+    case 's':
+      if (atoi(optarg)<1) {
+	cerr << "need at least one shard"<<endl;
+	return -1;
+      }
+      opts.shards=atoi(optarg);
+      break;
+    case 'd':
+      if (sscanf(optarg,"%lf,%lf",&opts.dirtyhigh,&opts.dirtylow)!=2) {
+	cerr << "expected -d high,low"<<endl;
+	return -1;
+      }
+      opts.dirtyhigh/=100;
+      opts.dirtylow/=100;
+      break;
+    case 'g':
+      opts.writebackgap=atoi(optarg);
+      break;
+    case 'm':
+      opts.mrcrate=atof(optarg)/100;
+      if (opts.mrcrate<=0 || opts.mrcrate>1) {
+	cerr << "expected -m percent between 0 and 100"<<endl;
+	return -1;
+      }
+      break;
+    case 'r':
+      if (atoi(optarg)<0) {
+	cerr << "expected -r blocks, 0 or more"<<endl;
+	return -1;
+      }
+      opts.readahead=atoi(optarg);
+      break;
+    case 't':
+      if (atoi(optarg)<0) {
+	cerr << "expected -t frames, 0 or more"<<endl;
+	return -1;
+      }
+      opts.protect=atoi(optarg);
+      break;
+    case 'a':
+      opts.admission=true;
+      break;
+    case 'w':
+      opts.warmrestart=true;
+      break;
+    case 'l':
+      opts.secondlevel=optarg;
+      break;
+    case 'i':
+      if (DiskSystem::ParseIOMode(optarg,opts.iomode)!=ERROR_NOERROR) {
+	cerr << "unknown disk I/O mode "<<optarg<<endl;
+	return -1;
+      }
+      break;
+    case 'q':
+      if (atoi(optarg)<1) {
+	cerr << "expected -q depth, 1 or more"<<endl;
+	return -1;
+      }
+      opts.queuedepth=atoi(optarg);
+      break;
+    default:
+      return -1;
+    }
+  }
+  return optind;
+}
+
+ERROR_T ApplyCacheOptions(BufferCache &cache, const CacheOptions &opts)
+{
+  ERROR_T rc;
+
+  if ((rc=cache.SetDirtyWatermarks(opts.dirtyhigh,opts.dirtylow))!=ERROR_NOERROR) {
+    cerr << "bad dirty watermarks"<<endl;
+    return rc;
+  }
+  cache.SetWritebackGap(opts.writebackgap);
+  if ((rc=cache.EnableMissRatioCurve(opts.mrcrate))!=ERROR_NOERROR) {
+    cerr << "bad miss ratio curve sampling rate"<<endl;
+    return rc;
+  }
+  cache.SetReadahead(opts.readahead);
+  cache.SetProtectedSize(opts.protect);
+  cache.SetAdmission(opts.admission);
+  cache.SetWarmRestart(opts.warmrestart);
+  if (opts.secondlevel &&
+      (rc=cache.SetSecondLevel(opts.secondlevel))!=ERROR_NOERROR) {
+    cerr << "can't use "<<opts.secondlevel<<" as a second level cache"<<endl;
+    return rc;
+  }
+  if ((rc=cache.SetDiskIOMode(opts.iomode))!=ERROR_NOERROR) {
+    cerr << "can't switch the disk to that I/O mode"<<endl;
+    return rc;
+  }
+  cache.SetDiskQueueDepth(opts.queuedepth);
+  return ERROR_NOERROR;
+}
+
+void CacheOptionsUsage(ostream &os)
+{
+  os << "  -p policy   cache replacement policy: lru (default), clock, 2q, arc, lru2\n";
+  os << "  -s shards   split the cache into this many shards (default 1)\n";
+  os << "  -d high,low write back in the background from high down to low\n"
+     << "              percent of the cache dirty (default off)\n";
+  os << "  -g gap      write back may rewrite up to gap clean blocks to merge\n"
+     << "              two runs of dirty ones (default 0)\n";
+  os << "  -m pct      estimate the miss ratio curve for other cache sizes,\n"
+     << "              sampling pct percent of the blocks (default off)\n";
+  os << "  -r max      read sequential streams ahead by up to max blocks\n"
+     << "              (default 0, off)\n";
+  os << "  -t frames   keep the root and interior nodes in a protected\n"
+     << "              tier of this many frames (default 0, off)\n";
+  os << "  -a          only keep new blocks that are used more often than\n"
+     << "              what they would evict (TinyLFU, default off)\n";
+  os << "  -w          save the cached blocks in filestem.warm at exit and\n"
+     << "              read them back in at start (default off)\n";
+  os << "  -l fast     copy blocks evicted from the cache to the faster disk\n"
+     << "              fast, made by makedisk, and read them back from there\n";
+  os << "  -i mode     reach the disk files with pread and pwrite (pread,\n"
+     << "              the default), the same bypassing the page cache\n"
+     << "              (direct), by mapping them (mmap), or with many\n"
+     << "              transfers in flight at once (async)\n";
+  os << "  -q depth    let the disk hold this many prefetches or write backs\n"
+     << "              and serve the nearest first (default 1)\n";
+}
@@ -0,0 +1,67 @@
+#ifndef _cacheoptions
+#define _cacheoptions
+
+#include <iostream>
+
+#include "global.h"
+#include "cachepolicy.h"
+#include "buffercache.h"
+
+using namespace std;
+
+//
+// Buffer cache options shared by the command line tools
+//
+// They come before the positional arguments:
+//
+//   -p policy    replacement policy: lru (default), clock, 2q, arc, lru2
+//   -s shards    number of shards to split the cache into (default 1)
+//   -d high,low  background write back between these dirty
+//                percentages (default off)
+//   -g gap       let write back bridge up to gap clean blocks (default 0)
+//   -m pct       estimate the miss ratio curve from pct percent of the
+//                blocks (default off)
+//   -r max       read sequential streams ahead by up to max blocks
+//                (default 0, off)
+//   -t frames    keep index nodes in a protected tier of this many
+//                frames (default 0, off)
+//   -a           admit new blocks through a TinyLFU filter (default off)
+//   -w           save the working set at exit and read it back in at
+//                start, in filestem.warm (default off)
+//   -l fast      keep blocks evicted from the cache on the faster disk
+//                with filestem fast (default none)
+//   -i mode      disk file I/O: pread (default), direct, mmap or async
+//   -q depth     requests the disk can queue and reorder (default 1)
+//
+struct CacheOptions {
+  CachePolicyType policy;
+  SIZE_T          shards;
+  double          dirtyhigh, dirtylow;
+  SIZE_T          writebackgap;
+  double          mrcrate;
+  SIZE_T          readahead;
+  SIZE_T          protect;
+  bool            admission;
+  bool            warmrestart;
+  const char     *secondlevel;
+  DiskIOMode      iomode;
+  SIZE_T          queuedepth;
+
+  CacheOptions() : policy(CACHE_POLICY_LRU), shards(1),
+		   dirtyhigh(0), dirtylow(0), writebackgap(0), mrcrate(0),
+		   readahead(0), protect(0), admission(false), warmrestart(false),
+		   secondlevel(0), iomode(DISK_IO_PREAD), queuedepth(1) {}
+};
+
+// Parses the options at the front of argv
+// returns the index of the first positional argument, or -1 on error
+int ParseCacheOptions(int argc, char **argv, CacheOptions &opts);
+
+// Applies the options that are not constructor arguments
+// returns ERROR_NOERROR or the first error
+ERROR_T ApplyCacheOptions(BufferCache &cache, const CacheOptions &opts);
+
+// Describes the options for a usage message
+void CacheOptionsUsage(ostream &os);
+
+#endif
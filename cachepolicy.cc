@@ -0,0 +1,764 @@
+#include <string.h>
+
+#include "cachepolicy.h"
+#include "buffercache.h"
+
+
+static inline bool Evictable(const BufferFrame *f)
+{
+  return f->pincount==0;
+}
+
+BufferFrame *OldestEvictable(const FrameList &l)
+{
+  BufferFrame *f;
+
+  for (f=l.tail; f && !Evictable(f); f=f->prev) {
+  }
+  return f;
+}
+
+
+void FrameList::PushFront(BufferFrame *f)
+{
+  f->prev=0;
+  f->next=head;
+  if (head) {
+    head->prev=f;
+  } else {
+    tail=f;
+  }
+  head=f;
+  size++;
+}
+
+void FrameList::PushBack(BufferFrame *f)
+{
+  f->next=0;
+  f->prev=tail;
+  if (tail) {
+    tail->next=f;
+  } else {
+    head=f;
+  }
+  tail=f;
+  size++;
+}
+
+void FrameList::InsertBefore(BufferFrame *pos, BufferFrame *f)
+{
+  if (!pos) {
+    PushBack(f);
+    return;
+  }
+  f->next=pos;
+  f->prev=pos->prev;
+  if (pos->prev) {
+    pos->prev->next=f;
+  } else {
+    head=f;
+  }
+  pos->prev=f;
+  size++;
+}
+
+void FrameList::Remove(BufferFrame *f)
+{
+  if (f->prev) {
+    f->prev->next=f->next;
+  } else {
+    head=f->next;
+  }
+  if (f->next) {
+    f->next->prev=f->prev;
+  } else {
+    tail=f->prev;
+  }
+  f->prev=f->next=0;
+  size--;
+}
+
+
+GhostList::GhostList(const SIZE_T cap) :
+  capacity(cap>0 ? cap : 1),
+  blocknums(capacity), prev(capacity), next(capacity), hashnext(capacity)
+{
+  SIZE_T numbuckets=1;
+
+  while (numbuckets < 2*capacity) {
+    numbuckets<<=1;
+  }
+  buckets.resize(numbuckets);
+  bucketmask=numbuckets-1;
+  Clear();
+}
+
+SIZE_T GhostList::Hash(const SIZE_T blocknum) const
+{
+  return (blocknum*2654435761U) & bucketmask;
+}
+
+int GhostList::Find(const SIZE_T blocknum) const
+{
+  int e;
+
+  for (e=buckets[Hash(blocknum)]; e>=0; e=hashnext[e]) {
+    if (blocknums[e]==blocknum) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+void GhostList::Unlink(const int e)
+{
+  int *p;
+
+  for (p=&(buckets[Hash(blocknums[e])]); *p>=0; p=&(hashnext[*p])) {
+    if (*p==e) {
+      *p=hashnext[e];
+      break;
+    }
+  }
+  if (prev[e]>=0) {
+    next[prev[e]]=next[e];
+  } else {
+    head=next[e];
+  }
+  if (next[e]>=0) {
+    prev[next[e]]=prev[e];
+  } else {
+    tail=prev[e];
+  }
+  next[e]=freelist;
+  freelist=e;
+  size--;
+}
+
+void GhostList::PushFront(const SIZE_T blocknum)
+{
+  int e=Find(blocknum);
+
+  if (e>=0) {
+    Unlink(e);
+  }
+  if (size==capacity) {
+    PopBack();
+  }
+  e=freelist;
+  freelist=next[e];
+
+  blocknums[e]=blocknum;
+  prev[e]=-1;
+  next[e]=head;
+  if (head>=0) {
+    prev[head]=e;
+  } else {
+    tail=e;
+  }
+  head=e;
+
+  SIZE_T h=Hash(blocknum);
+  hashnext[e]=buckets[h];
+  buckets[h]=e;
+  size++;
+}
+
+bool GhostList::Remove(const SIZE_T blocknum)
+{
+  int e=Find(blocknum);
+
+  if (e<0) {
+    return false;
+  }
+  Unlink(e);
+  return true;
+}
+
+void GhostList::PopBack()
+{
+  if (tail>=0) {
+    Unlink(tail);
+  }
+}
+
+void GhostList::Clear()
+{
+  SIZE_T i;
+
+  for (i=0;i<buckets.size();i++) {
+    buckets[i]=-1;
+  }
+  for (i=0;i<capacity;i++) {
+    next[i]= (i+1<capacity) ? (int)(i+1) : -1;
+  }
+  freelist=0;
+  head=tail=-1;
+  size=0;
+}
+
+void GhostList::SetCapacity(const SIZE_T cap)
+{
+  vector<SIZE_T> keep;
+  SIZE_T         numbuckets=1;
+  int            e;
+
+  // oldest last
+  for (e=head; e>=0 && keep.size()<cap; e=next[e]) {
+    keep.push_back(blocknums[e]);
+  }
+
+  capacity = cap>0 ? cap : 1;
+  blocknums.resize(capacity);
+  prev.resize(capacity);
+  next.resize(capacity);
+  hashnext.resize(capacity);
+  while (numbuckets < 2*capacity) {
+    numbuckets<<=1;
+  }
+  buckets.resize(numbuckets);
+  bucketmask=numbuckets-1;
+  Clear();
+
+  while (!keep.empty()) {
+    PushFront(keep.back());
+    keep.pop_back();
+  }
+}
+
+
+//
+// Frequency sketch
+//
+#define SKETCH_DEPTH   4
+#define SKETCH_MAX     15
+#define SKETCH_SAMPLES 10
+
+static const SIZE_T sketch_seeds[SKETCH_DEPTH] =
+  {0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU, 0x27d4eb2fU};
+
+FrequencySketch::FrequencySketch(const SIZE_T capacity) :
+  width(0), widthmask(0), additions(0), samplesize(0)
+{
+  SetCapacity(capacity);
+}
+
+SIZE_T FrequencySketch::Index(const SIZE_T row, const SIZE_T blocknum) const
+{
+  SIZE_T h=(blocknum+1)*sketch_seeds[row];
+
+  h^=h>>16;
+  return row*width + (h & widthmask);
+}
+
+// Conservative update: only the counters at the estimate go up,
+// which keeps collisions from inflating the others
+void FrequencySketch::Increment(const SIZE_T blocknum)
+{
+  unsigned est;
+
+  if (width==0) {
+    return;
+  }
+  est=Estimate(blocknum);
+  if (est<SKETCH_MAX) {
+    for (SIZE_T r=0;r<SKETCH_DEPTH;r++) {
+      SIZE_T i=Index(r,blocknum);
+      if (counters[i]==est) {
+	counters[i]++;
+      }
+    }
+  }
+  if (++additions>=samplesize) {
+    Age();
+  }
+}
+
+unsigned FrequencySketch::Estimate(const SIZE_T blocknum) const
+{
+  unsigned est=SKETCH_MAX;
+
+  if (width==0) {
+    return 0;
+  }
+  for (SIZE_T r=0;r<SKETCH_DEPTH;r++) {
+    unsigned c=counters[Index(r,blocknum)];
+    if (c<est) {
+      est=c;
+    }
+  }
+  return est;
+}
+
+void FrequencySketch::Age()
+{
+  for (SIZE_T i=0;i<counters.size();i++) {
+    counters[i]>>=1;
+  }
+  additions/=2;
+}
+
+void FrequencySketch::Clear()
+{
+  counters.assign(counters.size(),0);
+  additions=0;
+}
+
+void FrequencySketch::SetCapacity(const SIZE_T capacity)
+{
+  width=0;
+  if (capacity>0) {
+    width=16;
+    while (width<capacity) {
+      width<<=1;
+    }
+  }
+  widthmask = width>0 ? width-1 : 0;
+  samplesize=SKETCH_SAMPLES*capacity;
+  counters.assign(SKETCH_DEPTH*width,0);
+  additions=0;
+}
+
+
+ostream & CachePolicy::Print(ostream &os) const
+{
+  os << GetName();
+  return os;
+}
+
+CachePolicy *CachePolicy::Create(const CachePolicyType type, const SIZE_T cachesize)
+{
+  switch (type) {
+  case CACHE_POLICY_CLOCK:
+    return new ClockPolicy();
+  case CACHE_POLICY_2Q:
+    return new TwoQueuePolicy(cachesize);
+  case CACHE_POLICY_ARC:
+    return new ARCPolicy(cachesize);
+  case CACHE_POLICY_LRU2:
+    return new LRU2Policy(cachesize);
+  case CACHE_POLICY_LRU:
+  default:
+    return new LRUPolicy();
+  }
+}
+
+ERROR_T CachePolicy::Parse(const char *name, CachePolicyType &type)
+{
+  if (!strcasecmp(name,"lru")) {
+    type=CACHE_POLICY_LRU;
+  } else if (!strcasecmp(name,"clock")) {
+    type=CACHE_POLICY_CLOCK;
+  } else if (!strcasecmp(name,"2q")) {
+    type=CACHE_POLICY_2Q;
+  } else if (!strcasecmp(name,"arc")) {
+    type=CACHE_POLICY_ARC;
+  } else if (!strcasecmp(name,"lru2") || !strcasecmp(name,"lru-2")) {
+    type=CACHE_POLICY_LRU2;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+
+//
+// LRU
+//
+void LRUPolicy::Insert(BufferFrame *f)
+{
+  list.PushFront(f);
+}
+
+void LRUPolicy::Touch(BufferFrame *f)
+{
+  if (f!=list.head) {
+    list.Remove(f);
+    list.PushFront(f);
+  }
+}
+
+void LRUPolicy::Remove(BufferFrame *f)
+{
+  list.Remove(f);
+}
+
+BufferFrame *LRUPolicy::Victim(const SIZE_T incoming)
+{
+  return OldestEvictable(list);
+}
+
+void LRUPolicy::Clear()
+{
+  list.Clear();
+}
+
+
+//
+// CLOCK
+//
+// New frames go just behind the hand, so they are the last the
+// hand reaches
+//
+void ClockPolicy::Insert(BufferFrame *f)
+{
+  f->referenced=true;
+  ring.InsertBefore(hand,f);
+}
+
+void ClockPolicy::Touch(BufferFrame *f)
+{
+  f->referenced=true;
+}
+
+void ClockPolicy::Remove(BufferFrame *f)
+{
+  if (hand==f) {
+    hand=f->next;
+  }
+  ring.Remove(f);
+}
+
+BufferFrame *ClockPolicy::Victim(const SIZE_T incoming)
+{
+  SIZE_T steps;
+
+  // two sweeps clear every reference bit, so after that
+  // only pinned frames can be left
+  for (steps=0; steps<=2*ring.size; steps++) {
+    if (!hand) {
+      hand=ring.head;
+    }
+    if (!hand) {
+      return 0;
+    }
+    if (Evictable(hand) && !hand->referenced) {
+      return hand;
+    }
+    hand->referenced=false;
+    hand=hand->next;
+  }
+  return 0;
+}
+
+void ClockPolicy::Clear()
+{
+  ring.Clear();
+  hand=0;
+}
+
+
+//
+// 2Q
+//
+// Sizes follow the paper's recommendation: A1in holds a quarter
+// of the cache and A1out remembers half a cache's worth of blocks.
+//
+#define TWOQ_A1IN 1
+#define TWOQ_AM   2
+
+TwoQueuePolicy::TwoQueuePolicy(const SIZE_T cachesize) :
+  kin(cachesize/4 > 0 ? cachesize/4 : 1),
+  a1out(cachesize/2 > 0 ? cachesize/2 : 1)
+{}
+
+void TwoQueuePolicy::Insert(BufferFrame *f)
+{
+  if (a1out.Remove(f->blocknum)) {
+    f->queue=TWOQ_AM;
+    am.PushFront(f);
+  } else {
+    f->queue=TWOQ_A1IN;
+    a1in.PushFront(f);
+  }
+}
+
+void TwoQueuePolicy::Touch(BufferFrame *f)
+{
+  // hits in A1in are treated as correlated and ignored
+  if (f->queue==TWOQ_AM && f!=am.head) {
+    am.Remove(f);
+    am.PushFront(f);
+  }
+}
+
+void TwoQueuePolicy::Remove(BufferFrame *f)
+{
+  if (f->queue==TWOQ_A1IN) {
+    a1in.Remove(f);
+    a1out.PushFront(f->blocknum);
+  } else {
+    am.Remove(f);
+  }
+  f->queue=0;
+}
+
+BufferFrame *TwoQueuePolicy::Victim(const SIZE_T incoming)
+{
+  BufferFrame *f=0;
+
+  if (a1in.size>kin) {
+    f=OldestEvictable(a1in);
+  }
+  if (!f) {
+    f=OldestEvictable(am);
+  }
+  if (!f) {
+    f=OldestEvictable(a1in);
+  }
+  return f;
+}
+
+void TwoQueuePolicy::Clear()
+{
+  a1in.Clear();
+  am.Clear();
+  a1out.Clear();
+}
+
+void TwoQueuePolicy::Resize(const SIZE_T cachesize)
+{
+  kin = cachesize/4 > 0 ? cachesize/4 : 1;
+  a1out.SetCapacity(cachesize/2 > 0 ? cachesize/2 : 1);
+}
+
+ostream & TwoQueuePolicy::Print(ostream &os) const
+{
+  os << "2q(a1in="<<a1in.size<<", am="<<am.size<<", a1out="<<a1out.GetSize()<<")";
+  return os;
+}
+
+
+//
+// ARC
+//
+#define ARC_T1 1
+#define ARC_T2 2
+
+ARCPolicy::ARCPolicy(const SIZE_T cachesize) :
+  c(cachesize>0 ? cachesize : 1), p(0),
+  b1(c), b2(c)
+{}
+
+void ARCPolicy::Trim()
+{
+  // |T1|+|B1| <= c and |T1|+|T2|+|B1|+|B2| <= 2c
+  while (t1.size+b1.GetSize() > c && b1.GetSize()>0) {
+    b1.PopBack();
+  }
+  while (t1.size+t2.size+b1.GetSize()+b2.GetSize() > 2*c && b2.GetSize()>0) {
+    b2.PopBack();
+  }
+}
+
+void ARCPolicy::Insert(BufferFrame *f)
+{
+  SIZE_T delta;
+
+  if (b1.Contains(f->blocknum)) {
+    // we evicted this from T1 too early, so grow T1
+    delta = b1.GetSize()>=b2.GetSize() ? 1 : b2.GetSize()/b1.GetSize();
+    p = (p+delta < c) ? p+delta : c;
+    b1.Remove(f->blocknum);
+    f->queue=ARC_T2;
+    t2.PushFront(f);
+  } else if (b2.Contains(f->blocknum)) {
+    // we evicted this from T2 too early, so shrink T1
+    delta = b2.GetSize()>=b1.GetSize() ? 1 : b1.GetSize()/b2.GetSize();
+    p = (p>delta) ? p-delta : 0;
+    b2.Remove(f->blocknum);
+    f->queue=ARC_T2;
+    t2.PushFront(f);
+  } else {
+    f->queue=ARC_T1;
+    t1.PushFront(f);
+  }
+  Trim();
+}
+
+void ARCPolicy::Touch(BufferFrame *f)
+{
+  if (f->queue==ARC_T1) {
+    t1.Remove(f);
+  } else {
+    t2.Remove(f);
+  }
+  f->queue=ARC_T2;
+  t2.PushFront(f);
+}
+
+void ARCPolicy::Remove(BufferFrame *f)
+{
+  if (f->queue==ARC_T1) {
+    t1.Remove(f);
+    b1.PushFront(f->blocknum);
+  } else {
+    t2.Remove(f);
+    b2.PushFront(f->blocknum);
+  }
+  f->queue=0;
+  Trim();
+}
+
+BufferFrame *ARCPolicy::Victim(const SIZE_T incoming)
+{
+  BufferFrame *f=0;
+
+  // REPLACE from the paper
+  if (t1.size>0 &&
+      (t1.size>p || (b2.Contains(incoming) && t1.size==p))) {
+    f=OldestEvictable(t1);
+    if (!f) {
+      f=OldestEvictable(t2);
+    }
+  } else {
+    f=OldestEvictable(t2);
+    if (!f) {
+      f=OldestEvictable(t1);
+    }
+  }
+  return f;
+}
+
+void ARCPolicy::Clear()
+{
+  t1.Clear();
+  t2.Clear();
+  b1.Clear();
+  b2.Clear();
+  p=0;
+}
+
+void ARCPolicy::Resize(const SIZE_T cachesize)
+{
+  c = cachesize>0 ? cachesize : 1;
+  if (p>c) {
+    p=c;
+  }
+  b1.SetCapacity(c);
+  b2.SetCapacity(c);
+  Trim();
+}
+
+ostream & ARCPolicy::Print(ostream &os) const
+{
+  os << "arc(p="<<p<<", t1="<<t1.size<<", t2="<<t2.size
+     <<", b1="<<b1.GetSize()<<", b2="<<b2.GetSize()<<")";
+  return os;
+}
+
+
+//
+// LRU-2
+//
+// hist[0] is the logical time of the last reference and hist[1]
+// that of the one before; zero means never
+//
+LRU2Policy::LRU2Policy(const SIZE_T cachesize) : tick(0)
+{
+  heap.reserve(cachesize>0 ? cachesize : 1);
+}
+
+bool LRU2Policy::Before(const BufferFrame *a, const BufferFrame *b) const
+{
+  if (a->hist[1]!=b->hist[1]) {
+    return a->hist[1]<b->hist[1];
+  }
+  return a->hist[0]<b->hist[0];
+}
+
+void LRU2Policy::Place(const SIZE_T pos, BufferFrame *f)
+{
+  heap[pos]=f;
+  f->heappos=pos;
+}
+
+void LRU2Policy::SiftUp(SIZE_T pos)
+{
+  BufferFrame *f=heap[pos];
+
+  while (pos>0 && Before(f,heap[(pos-1)/2])) {
+    Place(pos,heap[(pos-1)/2]);
+    pos=(pos-1)/2;
+  }
+  Place(pos,f);
+}
+
+void LRU2Policy::SiftDown(SIZE_T pos)
+{
+  BufferFrame *f=heap[pos];
+  SIZE_T n=heap.size();
+
+  while (2*pos+1<n) {
+    SIZE_T child=2*pos+1;
+    if (child+1<n && Before(heap[child+1],heap[child])) {
+      child++;
+    }
+    if (!Before(heap[child],f)) {
+      break;
+    }
+    Place(pos,heap[child]);
+    pos=child;
+  }
+  Place(pos,f);
+}
+
+void LRU2Policy::Insert(BufferFrame *f)
+{
+  f->hist[0]=++tick;
+  f->hist[1]=0;
+  heap.push_back(f);
+  SiftUp(heap.size()-1);
+}
+
+void LRU2Policy::Touch(BufferFrame *f)
+{
+  f->hist[1]=f->hist[0];
+  f->hist[0]=++tick;
+  // keys only grow
+  SiftDown(f->heappos);
+}
+
+void LRU2Policy::Remove(BufferFrame *f)
+{
+  SIZE_T pos=f->heappos;
+  BufferFrame *last=heap.back();
+
+  heap.pop_back();
+  if (last!=f) {
+    Place(pos,last);
+    SiftDown(pos);
+    SiftUp(last->heappos);
+  }
+}
+
+BufferFrame *LRU2Policy::Victim(const SIZE_T incoming)
+{
+  BufferFrame *best=0;
+
+  if (heap.empty()) {
+    return 0;
+  }
+  if (Evictable(heap[0])) {
+    return heap[0];
+  }
+  // The top is pinned.  Pins are few and recently used, so this
+  // is rare; fall back to a scan.
+  for (SIZE_T i=1;i<heap.size();i++) {
+    if (Evictable(heap[i]) && (!best || Before(heap[i],best))) {
+      best=heap[i];
+    }
+  }
+  return best;
+}
+
+void LRU2Policy::Clear()
+{
+  heap.clear();
+  tick=0;
+}
+
+void LRU2Policy::Resize(const SIZE_T cachesize)
+{
+  heap.reserve(cachesize);
+}
@@ -0,0 +1,247 @@
+#ifndef _cachepolicy
+#define _cachepolicy
+
+#include <iostream>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+struct BufferFrame;
+
+enum CachePolicyType {CACHE_POLICY_LRU, CACHE_POLICY_CLOCK, CACHE_POLICY_2Q,
+		      CACHE_POLICY_ARC, CACHE_POLICY_LRU2};
+
+
+//
+// Intrusive doubly linked list of frames, threaded through
+// BufferFrame::prev and next.  Head is the most recent end.
+//
+struct FrameList {
+  BufferFrame *head;
+  BufferFrame *tail;
+  SIZE_T       size;
+
+  FrameList() : head(0), tail(0), size(0) {}
+
+  void PushFront(BufferFrame *f);
+  void PushBack(BufferFrame *f);
+  void InsertBefore(BufferFrame *pos, BufferFrame *f);
+  void Remove(BufferFrame *f);
+  void Clear() { head=tail=0; size=0; }
+};
+
+// Oldest unpinned frame on a list, or 0
+BufferFrame *OldestEvictable(const FrameList &l);
+
+
+//
+// Fixed capacity list of block numbers that are no longer resident
+// ("ghosts"), with a hash index.  Used by policies that learn from
+// recently evicted blocks.  Never allocates after construction.
+//
+class GhostList {
+ private:
+  SIZE_T capacity;
+  vector<SIZE_T> blocknums;
+  vector<int>    prev, next, hashnext;
+  vector<int>    buckets;
+  SIZE_T         bucketmask;
+  int            head, tail, freelist;
+  SIZE_T         size;
+
+  SIZE_T Hash(const SIZE_T blocknum) const;
+  int    Find(const SIZE_T blocknum) const;
+  void   Unlink(const int e);
+ public:
+  GhostList(const SIZE_T capacity);
+
+  bool   Contains(const SIZE_T blocknum) const { return Find(blocknum)>=0; }
+  // Adds at the most recent end, dropping the oldest entry if full
+  void   PushFront(const SIZE_T blocknum);
+  bool   Remove(const SIZE_T blocknum);
+  void   PopBack();
+  void   Clear();
+  // Keeps the most recent entries that fit
+  void   SetCapacity(const SIZE_T capacity);
+  SIZE_T GetSize() const { return size; }
+};
+
+
+//
+// Count-min sketch estimating how often each block has been
+// referenced lately, for TinyLFU admission.  Each block has a small
+// counter in each of a few rows, picked by a different hash; its
+// estimate is the least of them.  Counters stop at 15, and after
+// ten references per unit of capacity they are all halved, so old
+// popularity fades.  Capacity 0 leaves it empty.
+//
+class FrequencySketch {
+ private:
+  vector<unsigned char> counters;  // rows of width counters each
+  SIZE_T                width;
+  SIZE_T                widthmask;
+  SIZE_T                additions;
+  SIZE_T                samplesize;
+
+  SIZE_T Index(const SIZE_T row, const SIZE_T blocknum) const;
+  void   Age();
+ public:
+  FrequencySketch(const SIZE_T capacity=0);
+
+  void     Increment(const SIZE_T blocknum);
+  unsigned Estimate(const SIZE_T blocknum) const;
+  void     Clear();
+  // Resizes for about capacity distinct blocks, forgetting all counts
+  void     SetCapacity(const SIZE_T capacity);
+};
+
+
+//
+// Replacement policy interface for BufferCache
+//
+// The cache tells the policy when a frame becomes resident, is hit,
+// or leaves.  When it needs room it asks for a victim, passing the
+// block it is about to bring in.  A policy must never pick a pinned
+// frame and returns 0 if every frame is pinned.  Victim does not
+// remove the frame; the cache calls Remove when it evicts.  Resize
+// tells the policy the cache has been given a new size.
+//
+class CachePolicy {
+ public:
+  virtual ~CachePolicy() {}
+
+  virtual void         Insert(BufferFrame *f)=0;
+  virtual void         Touch(BufferFrame *f)=0;
+  virtual void         Remove(BufferFrame *f)=0;
+  virtual BufferFrame *Victim(const SIZE_T incoming)=0;
+  virtual void         Clear()=0;
+  virtual void         Resize(const SIZE_T cachesize) {}
+
+  virtual const char  *GetName() const=0;
+  virtual ostream     &Print(ostream &os) const;
+
+  static CachePolicy  *Create(const CachePolicyType type, const SIZE_T cachesize);
+
+  // Maps "lru", "clock", "2q", "arc" or "lru2" to a policy type
+  // returns ERROR_NOERROR or ERROR_BADCONFIG
+  static ERROR_T       Parse(const char *name, CachePolicyType &type);
+};
+
+
+inline ostream & operator<<(ostream &os, const CachePolicy &p) { return p.Print(os); }
+
+
+//
+// Least recently used
+//
+class LRUPolicy : public CachePolicy {
+ private:
+  FrameList list;
+ public:
+  void         Insert(BufferFrame *f);
+  void         Touch(BufferFrame *f);
+  void         Remove(BufferFrame *f);
+  BufferFrame *Victim(const SIZE_T incoming);
+  void         Clear();
+  const char  *GetName() const { return "lru"; }
+};
+
+
+//
+// CLOCK (second chance): frames sit on a circle swept by a hand;
+// a referenced frame has its bit cleared and is passed over once
+//
+class ClockPolicy : public CachePolicy {
+ private:
+  FrameList    ring;
+  BufferFrame *hand;
+ public:
+  ClockPolicy() : hand(0) {}
+  void         Insert(BufferFrame *f);
+  void         Touch(BufferFrame *f);
+  void         Remove(BufferFrame *f);
+  BufferFrame *Victim(const SIZE_T incoming);
+  void         Clear();
+  const char  *GetName() const { return "clock"; }
+};
+
+
+//
+// 2Q (Johnson and Shasha): new blocks enter the A1in FIFO and are
+// remembered in the A1out ghost list when they leave it.  Blocks
+// re-referenced while in A1out are promoted to the Am LRU list.
+//
+class TwoQueuePolicy : public CachePolicy {
+ private:
+  SIZE_T    kin;        // target size of A1in
+  FrameList a1in, am;
+  GhostList a1out;
+ public:
+  TwoQueuePolicy(const SIZE_T cachesize);
+  void         Insert(BufferFrame *f);
+  void         Touch(BufferFrame *f);
+  void         Remove(BufferFrame *f);
+  BufferFrame *Victim(const SIZE_T incoming);
+  void         Clear();
+  void         Resize(const SIZE_T cachesize);
+  const char  *GetName() const { return "2q"; }
+  ostream     &Print(ostream &os) const;
+};
+
+
+//
+// ARC (Megiddo and Modha): T1 holds blocks seen once recently, T2
+// blocks seen at least twice.  Ghost lists B1 and B2 remember what
+// each lost, and hits in them move the target size p of T1.
+//
+class ARCPolicy : public CachePolicy {
+ private:
+  SIZE_T    c;
+  SIZE_T    p;
+  FrameList t1, t2;
+  GhostList b1, b2;
+
+  void         Trim();
+ public:
+  ARCPolicy(const SIZE_T cachesize);
+  void         Insert(BufferFrame *f);
+  void         Touch(BufferFrame *f);
+  void         Remove(BufferFrame *f);
+  BufferFrame *Victim(const SIZE_T incoming);
+  void         Clear();
+  void         Resize(const SIZE_T cachesize);
+  const char  *GetName() const { return "arc"; }
+  ostream     &Print(ostream &os) const;
+};
+
+
+//
+// LRU-2 (O'Neil, O'Neil and Weikum): evict the frame whose second
+// most recent reference is oldest.  Frames referenced only once
+// count as infinitely old and go first, least recent first.
+// Kept in a binary heap, so each operation is O(log cachesize).
+//
+class LRU2Policy : public CachePolicy {
+ private:
+  vector<BufferFrame *> heap;
+  unsigned long         tick;
+
+  bool  Before(const BufferFrame *a, const BufferFrame *b) const;
+  void  Place(const SIZE_T pos, BufferFrame *f);
+  void  SiftUp(SIZE_T pos);
+  void  SiftDown(SIZE_T pos);
+ public:
+  LRU2Policy(const SIZE_T cachesize);
+  void         Insert(BufferFrame *f);
+  void         Touch(BufferFrame *f);
+  void         Remove(BufferFrame *f);
+  BufferFrame *Victim(const SIZE_T incoming);
+  void         Clear();
+  void         Resize(const SIZE_T cachesize);
+  const char  *GetName() const { return "lru2"; }
+};
+
+
+#endif
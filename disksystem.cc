@@ -1,25 +1,49 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #include <string.h>
 #include <stdio.h>
 
 #include <math.h>
 
+#include <algorithm>
+
 #include "disksystem.h"
+#include "flashdisk.h"
+
 
+// Direct I/O needs offsets, lengths and buffers aligned to the
+// device's logical block size
+#define DIRECT_IO_ALIGN 512
+// Alignment of the bounce buffer; a page suits any device
+#define BOUNCE_ALIGN    4096
+// Transfers the async engine keeps in flight
+#define ASYNC_IO_DEPTH  64
+// Set to 0 to always use the thread pool for async I/O
+#ifndef ASYNC_IO_URING
+#define ASYNC_IO_URING  1
+#endif
 
-static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int len)
+
+static SIZE_T mywrite(int fd, const SIZE_T off, const BYTE_T *buf, const int len)
 {
-  SIZE_T left=len;
-  SIZE_T sent;
+  SIZE_T  left=len;
+  ssize_t sent;
 
-  fseek(f,off,SEEK_SET);
   while (left>0) {
-    sent=fwrite(&(buf[len-left]),1,left,f);
+    sent=pwrite(fd,&(buf[len-left]),left,off+(len-left));
     if (sent<0) {	
-      return 0;
+      if (errno==EINTR) { 
+	continue;
+      }
+      break;
     } else if (sent==0) {
       break;
     } else {
@@ -29,40 +53,28 @@ static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int le
   return len-left;
 }
 
-static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool trunconeof=true)
+static SIZE_T myread(int fd, const SIZE_T off, BYTE_T *buf, const int len, const bool zeroateof=true)
 {
-  SIZE_T left=len;
-  SIZE_T sent;
+  SIZE_T  left=len;
+  ssize_t sent;
 
-  fseek(f,off,SEEK_SET);
   while (left>0) {
-    sent=fread(&(buf[len-left]),1,left,f);
+    sent=pread(fd,&(buf[len-left]),left,off+(len-left));
     if (sent<0) {	
-      return 0;
+      if (errno==EINTR) { 
+	continue;
+      }
+      break;
     } else if (sent==0) {
-      // if we reached this point, the likely cause is that we
-      // are trying to read a block which has not been allocated yet
-      // Hence, we will try to ftruncate to this size and then retry the
-      // read.  However, we don't want to loop forever doing this,
-      // hence the trunconeof parameter
-      if (!feof(f)) { 
-	// OK, the end of file is not the problem
-	break;
-      } else {
-	// EOF case... should we truncate and try again?
-	if (!trunconeof) { 
-	  break;
-	} else {
-	  // yes!
-	  if (ftruncate(fileno(f),off+len)) { 
-	    // uh oh, something weird is going on
-	    break;
-	  } else {
-	    // OK, now retry, but don't truncate a second time
-	    return myread(f,off,buf,len,false);
-	  }
-	}
+      // if we reached this point, we are at the end of the file,
+      // likely because we are trying to read a block which has never
+      // been written.  It reads as zeros, as it would once written
+      // past; a read leaves the file as it is.
+      if (zeroateof) { 
+	memset(&(buf[len-left]),0,left);
+	left=0;
       }
+      break;
     } else {
       left-=sent;
     }
@@ -71,6 +83,57 @@ static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool
 }
 
 
+// Moves the bytes described by iov to or from off with preadv or
+// pwritev, IOV_MAX buffers at a time, picking up after short
+// transfers.  Like myread, a read that runs off the end of the
+// file reads zeros from there on.  iov is used up.
+static SIZE_T myrwv(int fd, const SIZE_T off, struct iovec *iov, int cnt,
+		    const bool write, const bool zeroateof=true)
+{
+  SIZE_T  len=0;
+  SIZE_T  done=0;
+  ssize_t n;
+
+  for (int i=0;i<cnt;i++) { 
+    len+=iov[i].iov_len;
+  }
+
+  while (cnt>0) { 
+    int chunk = cnt<IOV_MAX ? cnt : IOV_MAX;
+    if (write) { 
+      n=pwritev(fd,iov,chunk,off+done);
+    } else {
+      n=preadv(fd,iov,chunk,off+done);
+    }
+    if (n<0) { 
+      if (errno==EINTR) { 
+	continue;
+      }
+      break;
+    } else if (n==0) { 
+      if (!write && zeroateof) { 
+	for (int i=0;i<cnt;i++) { 
+	  memset(iov[i].iov_base,0,iov[i].iov_len);
+	}
+	done=len;
+      }
+      break;
+    }
+    done+=n;
+    while (cnt>0 && (SIZE_T)n>=iov[0].iov_len) { 
+      n-=iov[0].iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt>0) { 
+      iov[0].iov_base=(BYTE_T *)iov[0].iov_base+n;
+      iov[0].iov_len-=n;
+    }
+  }
+  return done;
+}
+
+
 DiskSystem::DiskSystem(const string &filestem,
 		       const bool   create,
 		       const SIZE_T offset,
@@ -82,10 +145,26 @@ DiskSystem::DiskSystem(const string &filestem,
 		       const double avgseek,
 		       const double trackseek,
 		       const double rotlat) :
+  DiskSystem("disk",filestem,create,offset,blcks,blcksize,heads,
+	     blckspertrack,tracks,avgseek,trackseek,rotlat)
+{}
+
+DiskSystem::DiskSystem(const string &model,
+		       const string &filestem,
+		       const bool   create,
+		       const SIZE_T offset,
+		       const SIZE_T blcks,
+		       const SIZE_T blcksize,
+		       const SIZE_T heads,
+		       const SIZE_T blckspertrack,
+		       const SIZE_T tracks,
+		       const double avgseek,
+		       const double trackseek,
+		       const double rotlat) :
   bitmap(0),
-  datafilefd(0),
+  datafd(-1),
   configfilefd(0),
-  bitmapfilefd(0),
+  bitmapfd(-1),
   diskfilestem(filestem), 
   offset(offset),
   numblocks(blcks),
@@ -97,7 +176,19 @@ DiskSystem::DiskSystem(const string &filestem,
   last_sector(0),
   averageseeklatency(avgseek),
   trackseeklatency(trackseek),
-  rotationallatency(rotlat)
+  rotationallatency(rotlat),
+  model(model),
+  queuedepth(1),
+  iomode(DISK_IO_PREAD),
+  datamap(0),
+  datamaplen(0),
+  bitmapmapped(false),
+  bitmapshared(false),
+  directfd(-1),
+  bouncebuf(0),
+  bouncesize(0),
+  aio(0),
+  outstanding(0)
 {
   if (create) { 
     // Only in this case are the parameters used:
@@ -109,17 +200,22 @@ DiskSystem::DiskSystem(const string &filestem,
 
 DiskSystem::~DiskSystem()
 {
+  StopAsync();
+  UnmapFiles();
+  CloseDirect();
   WriteConfig();
   WriteBitMap();
   fclose(configfilefd);
-  fclose(bitmapfilefd);
-  fclose(datafilefd);
-  delete [] bitmap;
+  ReleaseBitMap();
+  close(bitmapfd);
+  close(datafd);
 }
 
 ERROR_T DiskSystem::SanityCheckConfig()
 {
-  if (averageseeklatency<=0 || trackseeklatency<=0 || rotationallatency<=0) { 
+  // other models check their own parameters
+  if (model=="disk" &&
+      (averageseeklatency<=0 || trackseeklatency<=0 || rotationallatency<=0)) { 
     cerr << "Impossible performance.\n";
     return ERROR_BADCONFIG;
   }
@@ -157,6 +253,12 @@ ERROR_T DiskSystem::WriteConfig()
   fprintf(configfilefd,"%lf\n",trackseeklatency);
   fprintf(configfilefd,"# rotationalatency\n");
   fprintf(configfilefd,"%lf\n",rotationallatency);
+  fprintf(configfilefd,"# model\n");
+  fprintf(configfilefd,"%s\n",model.c_str());
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    fprintf(configfilefd,"# %s\n",modelparams[i].first.c_str());
+    fprintf(configfilefd,"%lf\n",modelparams[i].second);
+  }
   fflush(configfilefd);
 
   return ERROR_NOERROR;
@@ -197,40 +299,113 @@ ERROR_T DiskSystem::ReadConfig()
   GETNEXTVAL;
   PARSEDOUBLE(&rotationallatency);
 
+  // Then the model, if the file is new enough to say, and its
+  // parameters, each after a comment naming it
+  string name;
+
+  model="disk";
+  modelparams.clear();
+  while (fgets(buf,80,configfilefd)) { 
+    if (buf[strlen(buf)-1]=='\n') { 
+      buf[strlen(buf)-1]=0;
+    }
+    if (buf[0]=='#') { 
+      name=string(buf+(buf[1]==' ' ? 2 : 1));
+    } else if (name=="model") { 
+      model=string(buf);
+    } else if (!name.empty()) { 
+      double value=0;
+      PARSEDOUBLE(&value);
+      modelparams.push_back(make_pair(name,value));
+    }
+  }
+
   return ERROR_NOERROR;
 }
 
 
+SIZE_T DiskSystem::NumBitMapBytes() const
+{
+  return numblocks / 8 + (numblocks%8 != 0);
+}
+
 ERROR_T DiskSystem::WriteBitMap()
 {
-  rewind(bitmapfilefd);
-  
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
+  SIZE_T numbitmapbytes = NumBitMapBytes();
+  SIZE_T pagesize = allocator.GetPageSize();
+  vector<SIZE_T> pages;
+  SIZE_T i, j;
 
-  if (mywrite(bitmapfilefd,0,bitmap,numbitmapbytes)!=numbitmapbytes) { 
-    cerr << "Can't write bitmap file\n";
-    return ERROR_IMPLBUG;
+  allocator.GetDirtyPages(pages);
+
+  // each run of changed pages in one go
+  for (i=0;i<pages.size();i=j) { 
+    for (j=i+1;j<pages.size() && pages[j]==pages[j-1]+1;j++) {}
+
+    SIZE_T start = pages[i]*pagesize;
+    SIZE_T end = (pages[j-1]+1)*pagesize;
+    if (end>numbitmapbytes) { 
+      end=numbitmapbytes;
+    }
+    if (bitmapshared) { 
+      // the mapping is the file
+      if (msync(bitmap+start,end-start,MS_SYNC)) { 
+	cerr << "Can't write bitmap file\n";
+	return ERROR_IMPLBUG;
+      }
+    } else if (mywrite(bitmapfd,start,bitmap+start,end-start)!=end-start) { 
+      cerr << "Can't write bitmap file\n";
+      return ERROR_IMPLBUG;
+    }
   }
+  allocator.CleanPages();
   return ERROR_NOERROR;
 }
 
 ERROR_T DiskSystem::ReadBitMap()
 {
-  rewind(bitmapfilefd);
-  
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-
-  if (bitmap) { delete [] bitmap; } ;
+  SIZE_T numbitmapbytes = NumBitMapBytes();
+  struct stat s;
+  void *bm;
 
-  bitmap = new BYTE_T [numbitmapbytes];
+  ReleaseBitMap();
 
-  if (myread(bitmapfilefd,0,bitmap,numbitmapbytes,false)!=numbitmapbytes) { 
+  if (fstat(bitmapfd,&s) || (SIZE_T)s.st_size<numbitmapbytes) { 
     cerr << "Can't read bitmap file\n";
     return ERROR_IMPLBUG;
   }
+
+  bm = mmap(0,numbitmapbytes,PROT_READ|PROT_WRITE,MAP_PRIVATE,bitmapfd,0);
+  if (bm!=MAP_FAILED) { 
+    bitmap = (BYTE_T *) bm;
+    bitmapmapped = true;
+  } else {
+    bitmap = new BYTE_T [numbitmapbytes];
+
+    if (myread(bitmapfd,0,bitmap,numbitmapbytes,false)!=numbitmapbytes) { 
+      cerr << "Can't read bitmap file\n";
+      ReleaseBitMap();
+      return ERROR_IMPLBUG;
+    }
+  }
+  allocator.Attach(bitmap,numblocks,sysconf(_SC_PAGESIZE));
   return ERROR_NOERROR;
 }
 
+// Drops the bitmap without writing it back
+void DiskSystem::ReleaseBitMap()
+{
+  if (bitmapmapped) { 
+    munmap(bitmap,NumBitMapBytes());
+  } else {
+    delete [] bitmap;
+  }
+  bitmap = 0;
+  bitmapmapped = false;
+  bitmapshared = false;
+  allocator.Attach(0,0,0);
+}
+
 
 
 ERROR_T DiskSystem::InitFromConfigFile()
@@ -257,16 +432,16 @@ ERROR_T DiskSystem::InitFromConfigFile()
     return rc;
   }
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafd>=0) { close(datafd);}
 
-  if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+  if ((datafd = open(dataname.c_str(),O_RDWR))<0) { 
     return ERROR_NOFILE;
   }
 
 
-  if (bitmapfilefd) { fclose(bitmapfilefd);}
+  if (bitmapfd>=0) { close(bitmapfd);}
 
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"r+"))==0) { 
+  if ((bitmapfd = open(bitmapname.c_str(),O_RDWR))<0) { 
     return ERROR_NOFILE;
   }
   
@@ -322,23 +497,20 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   }
 
 
-  // allocate in-memory bitmap
-
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-  
-  bitmap = new BYTE_T [numbitmapbytes];
-
-  memset(bitmap,0,numbitmapbytes);
+  // create the bitmap file, all free, without writing it out, and
+  // map it
 
-  // create the bitmap file and write out the bitmap
+  if (bitmapfd>=0) { close(bitmapfd); }
 
-  if (bitmapfilefd) { fclose(bitmapfilefd); }
+  if ((bitmapfd = open(bitmapname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
+    return ERROR_NOFILE;
+  }
 
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"w+"))==0) { 
+  if (ftruncate(bitmapfd,NumBitMapBytes())) { 
     return ERROR_NOFILE;
   }
 
-  rc = WriteBitMap();
+  rc = ReadBitMap();
   
   if (rc) { 
     return rc;
@@ -348,16 +520,16 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   // notice that we will REUSE an existing data file if it exists
   // The idea is that we will write only from offset to offset+blocksize*numblocks
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafd>=0) { close(datafd);}
 
   if (stat(dataname.c_str(),&s)!=-1) { 
     // reuse existing datafile
-    if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+    if ((datafd = open(dataname.c_str(),O_RDWR))<0) { 
       return ERROR_NOFILE;
     }
   } else {
     // create new data file
-    if ((datafilefd = fopen(dataname.c_str(),"w+"))==0) { 
+    if ((datafd = open(dataname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
       return ERROR_NOFILE;
     }
   }
@@ -367,21 +539,479 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
 
 
 
-    
 
-//
-// Note, this assumes disk is kept continously busy
-// or that time does not advance except during a disk op
-//
-double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) 
+// Maps all of the data file up to the end of the disk, and the
+// bitmap file shared, so the bitmap changes the file as it changes
+ERROR_T DiskSystem::MapFiles()
+{
+  size_t datalen = (size_t)offset + (size_t)numblocks*blocksize;
+  SIZE_T numbitmapbytes = NumBitMapBytes();
+  struct stat s;
+  void *d, *bm;
+
+  if (datafd<0 || bitmapfd<0 || !bitmap) { 
+    return ERROR_NOFILE;
+  }
+
+  // the file has to hold the bitmap before it can stand in for it
+  if (WriteBitMap()!=ERROR_NOERROR) { 
+    return ERROR_NOFILE;
+  }
+
+  // a new disk's data file is empty, and mapped pages past its end
+  // can't be touched, so grow it (with zeros) to cover every block
+  if (fstat(datafd,&s)) { 
+    return ERROR_NOFILE;
+  }
+  if ((size_t)s.st_size<datalen && ftruncate(datafd,datalen)) { 
+    return ERROR_NOFILE;
+  }
+
+  d = mmap(0,datalen,PROT_READ|PROT_WRITE,MAP_SHARED,datafd,0);
+  if (d==MAP_FAILED) { 
+    return ERROR_NOMEM;
+  }
+  bm = mmap(0,numbitmapbytes,PROT_READ|PROT_WRITE,MAP_SHARED,bitmapfd,0);
+  if (bm==MAP_FAILED) { 
+    munmap(d,datalen);
+    return ERROR_NOMEM;
+  }
+
+  ReleaseBitMap();
+  bitmap = (BYTE_T *) bm;
+  bitmapmapped = true;
+  bitmapshared = true;
+  allocator.Attach(bitmap,numblocks,sysconf(_SC_PAGESIZE));
+  datamap = (BYTE_T *) d;
+  datamaplen = datalen;
+
+  return ERROR_NOERROR;
+}
+
+// Writes the mappings back and returns to a private bitmap
+void DiskSystem::UnmapFiles()
+{
+  if (datamap) { 
+    msync(datamap,datamaplen,MS_SYNC);
+    munmap(datamap,datamaplen);
+    datamap = 0;
+    datamaplen = 0;
+  }
+  if (bitmapshared) { 
+    WriteBitMap();
+    ReadBitMap();
+  }
+}
+
+// Opens a second, O_DIRECT, descriptor for the data file, and the
+// bounce buffer for blocks that aren't aligned
+ERROR_T DiskSystem::OpenDirect()
+{
+  string dataname = diskfilestem + ".data";
+
+  if (offset%DIRECT_IO_ALIGN || blocksize%DIRECT_IO_ALIGN) { 
+    return ERROR_BADCONFIG;
+  }
+  if (GrowBounce(blocksize)) { 
+    return ERROR_NOMEM;
+  }
+  // some file systems, tmpfs for one, refuse O_DIRECT
+  if ((directfd = open(dataname.c_str(),O_RDWR|O_DIRECT))<0) { 
+    CloseDirect();
+    return ERROR_NOFILE;
+  }
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::GrowBounce(const SIZE_T bytes)
+{
+  void *b;
+
+  if (bytes<=bouncesize) { 
+    return ERROR_NOERROR;
+  }
+  if (posix_memalign(&b,BOUNCE_ALIGN,bytes)) { 
+    return ERROR_NOMEM;
+  }
+  free(bouncebuf);
+  bouncebuf = (BYTE_T *) b;
+  bouncesize = bytes;
+
+  return ERROR_NOERROR;
+}
+
+void DiskSystem::CloseDirect()
+{
+  if (directfd>=0) { 
+    close(directfd);
+    directfd = -1;
+  }
+  free(bouncebuf);
+  bouncebuf = 0;
+  bouncesize = 0;
+}
+
+ERROR_T DiskSystem::SetIOMode(const DiskIOMode mode)
+{
+  ERROR_T rc;
+
+  if (mode==iomode) { 
+    return ERROR_NOERROR;
+  }
+  if (mode!=DISK_IO_PREAD && mode!=DISK_IO_DIRECT && mode!=DISK_IO_MMAP &&
+      mode!=DISK_IO_ASYNC) { 
+    return ERROR_BADCONFIG;
+  }
+
+  // open the new way in before closing the old
+  if (mode==DISK_IO_DIRECT && (rc=OpenDirect())) { 
+    return rc;
+  }
+  if (mode==DISK_IO_MMAP && (rc=MapFiles())) { 
+    return rc;
+  }
+  if (mode==DISK_IO_ASYNC && (aio=AsyncIO::Create(ASYNC_IO_DEPTH,ASYNC_IO_URING))==0) { 
+    return ERROR_NOMEM;
+  }
+  if (iomode==DISK_IO_DIRECT) { 
+    CloseDirect();
+  }
+  if (iomode==DISK_IO_MMAP) { 
+    UnmapFiles();
+  }
+  if (iomode==DISK_IO_ASYNC) { 
+    StopAsync();
+  }
+  iomode = mode;
+
+  return ERROR_NOERROR;
+}
+
+DiskIOMode DiskSystem::GetIOMode() const
+{
+  return iomode;
+}
+
+ERROR_T DiskSystem::ParseIOMode(const char *name, DiskIOMode &mode)
+{
+  if (!strcasecmp(name,"pread")) { 
+    mode = DISK_IO_PREAD;
+  } else if (!strcasecmp(name,"direct")) { 
+    mode = DISK_IO_DIRECT;
+  } else if (!strcasecmp(name,"mmap")) { 
+    mode = DISK_IO_MMAP;
+  } else if (!strcasecmp(name,"async")) { 
+    mode = DISK_IO_ASYNC;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+// Finishes whatever the engine has in flight, keeping it for Reap,
+// and shuts the engine down
+void DiskSystem::StopAsync()
+{
+  while (outstanding>0 && Collect()==ERROR_NOERROR) { 
+  }
+  delete aio;
+  aio = 0;
+}
+
+ERROR_T DiskSystem::Dispatch(DiskRequest **reqs, const SIZE_T n)
+{
+  if (!aio) { 
+    for (SIZE_T i=0;i<n;i++) { 
+      DiskRequest *r = reqs[i];
+      r->rc = r->write ? WriteData(r->blocknum,r->block->data) : ReadData(r->blocknum,r->block->data);
+      completed.push_back(r);
+    }
+    return ERROR_NOERROR;
+  }
+
+  aioscratch.clear();
+  for (SIZE_T i=0;i<n;i++) { 
+    DiskRequest *r = reqs[i];
+    r->io.fd = datafd;
+    r->io.write = r->write;
+    r->io.buf = r->block->data;
+    r->io.len = blocksize;
+    r->io.off = offset+r->blocknum*blocksize;
+    r->io.result = 0;
+    r->io.tag = r;
+    aioscratch.push_back(&(r->io));
+  }
+  outstanding += n;
+  return n>0 ? aio->Submit(&aioscratch[0],n) : ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::Collect()
+{
+  ERROR_T rc;
+
+  aioscratch.clear();
+  if ((rc=aio->Reap(aioscratch,1))) { 
+    return rc;
+  }
+  for (SIZE_T i=0;i<aioscratch.size();i++) { 
+    DiskRequest *r = (DiskRequest *) aioscratch[i]->tag;
+    outstanding--;
+    if (aioscratch[i]->result==(ssize_t)blocksize) { 
+      r->rc = ERROR_NOERROR;
+    } else {
+      // a short transfer, at the end of the file, or a failed one:
+      // try again directly, which reads zeros past the end as a plain
+      // read would
+      r->rc = r->write ? WriteData(r->blocknum,r->block->data) : ReadData(r->blocknum,r->block->data);
+    }
+    completed.push_back(r);
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::TransferRun(const SIZE_T first, const SIZE_T n,
+				BYTE_T * const *bufs, const bool write)
+{
+  bool aligned = true;
+  int  fd = datafd;
+
+  if (iomode==DISK_IO_DIRECT) { 
+    fd = directfd;
+    for (SIZE_T i=0;i<n;i++) { 
+      aligned = aligned && (uintptr_t)bufs[i]%DIRECT_IO_ALIGN==0;
+    }
+  }
+
+  if (iomode==DISK_IO_MMAP) { 
+    for (SIZE_T i=0;i<n;i++) { 
+      ERROR_T rc = write ? WriteData(first+i,bufs[i]) : ReadData(first+i,bufs[i]);
+      if (rc) { 
+	return rc;
+      }
+    }
+    return ERROR_NOERROR;
+  }
+
+  if (n==0) { 
+    return ERROR_NOERROR;
+  }
+  if (iov.size()<n) { 
+    iov.resize(n);
+  }
+
+  SIZE_T cnt = n;
+  if (aligned) { 
+    for (SIZE_T i=0;i<n;i++) { 
+      iov[i].iov_base = bufs[i];
+      iov[i].iov_len = blocksize;
+    }
+  } else {
+    // the whole run goes through the bounce buffer in one transfer
+    if (GrowBounce(n*blocksize)) { 
+      return ERROR_NOMEM;
+    }
+    if (write) { 
+      for (SIZE_T i=0;i<n;i++) { 
+	memcpy(bouncebuf+i*blocksize,bufs[i],blocksize);
+      }
+    }
+    iov[0].iov_base = bouncebuf;
+    iov[0].iov_len = n*blocksize;
+    cnt = 1;
+  }
+
+  if (myrwv(fd,offset+first*blocksize,&iov[0],cnt,write)!=n*blocksize) { 
+    if (write) { 
+      cerr << "DiskSystem::Write: pwritev has failed"<<endl;
+    } else {
+      cerr << "DiskSystem::Read: preadv has failed"<<endl;
+    }
+    return ERROR_IMPLBUG;
+  }
+
+  if (!aligned && !write) { 
+    for (SIZE_T i=0;i<n;i++) { 
+      memcpy(bufs[i],bouncebuf+i*blocksize,blocksize);
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::Submit(DiskRequest **reqs, const SIZE_T n, const double start)
+{
+  Schedule(reqs,n,start);
+  return Start(reqs,n);
+}
+
+void DiskSystem::Schedule(DiskRequest **reqs, const SIZE_T n, const double start)
+{
+  double t=start;
+  SIZE_T next=0;
+
+  ready.clear();
+
+  for (SIZE_T i=0;i<n;i++) { 
+    DiskRequest *r = reqs[i];
+    r->reqtime = 0;
+    r->finish = start;
+    r->rc = ERROR_NOERROR;
+    if (r->blocknum >= numblocks) { 
+      cerr << "DiskSystem::Schedule: Attempt to reach block "<<r->blocknum<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+      r->rc = ERROR_NOSPACE;
+    } else if (!r->write && r->block->Resize(blocksize,false)!=ERROR_NOERROR) { 
+      r->rc = ERROR_NOMEM;
+    } else if (r->write && r->block->length!=blocksize) { 
+      r->rc = ERROR_WRONGSIZEBLOCK;
+    }
+    if (!r->rc) { 
+      ready.push_back(r);
+    }
+  }
+
+  // Run the disk's queue.  It holds up to queuedepth requests,
+  // waiting or in service.  Whenever it can start one it takes in
+  // whatever has arrived and starts the one it can reach soonest; if
+  // nothing is waiting it idles until something arrives or, when
+  // full, until something finishes.
+  devqueue.clear();
+  inservice.clear();
+  while (next<ready.size() || !devqueue.empty()) { 
+    for (SIZE_T i=0;i<inservice.size();) { 
+      if (inservice[i]<=t) { 
+	inservice.erase(inservice.begin()+i);
+      } else {
+	i++;
+      }
+    }
+    while (next<ready.size() && devqueue.size()+inservice.size()<queuedepth &&
+	   ready[next]->issue<=t) { 
+      devqueue.push_back(ready[next++]);
+    }
+    if (devqueue.empty()) { 
+      if (inservice.size()<queuedepth) { 
+	t=ready[next]->issue;
+      } else {
+	t=*min_element(inservice.begin(),inservice.end());
+      }
+      continue;
+    }
+
+    SIZE_T best=0;
+    if (devqueue.size()>1) { 
+      double bestpos=PositioningTime(devqueue[0]->blocknum,devqueue[0]->write,t);
+      for (SIZE_T i=1;i<devqueue.size();i++) { 
+	double pos=PositioningTime(devqueue[i]->blocknum,devqueue[i]->write,t);
+	if (pos<bestpos) { 
+	  best=i;
+	  bestpos=pos;
+	}
+      }
+    }
+
+    DiskRequest *r=devqueue[best];
+    double       at=t;
+    devqueue.erase(devqueue.begin()+best);
+    t=Issue(r->blocknum,r->write,at,r->finish);
+    r->reqtime = r->finish-at;
+    inservice.push_back(r->finish);
+  }
+}
+
+ERROR_T DiskSystem::Start(DiskRequest **reqs, const SIZE_T n)
 {
+  ready.clear();
 
+  // those that can't start are finished already
+  for (SIZE_T i=0;i<n;i++) { 
+    if (reqs[i]->rc) { 
+      completed.push_back(reqs[i]);
+    } else {
+      ready.push_back(reqs[i]);
+    }
+  }
+  return ready.empty() ? ERROR_NOERROR : Dispatch(&ready[0],ready.size());
+}
+
+ERROR_T DiskSystem::Reap(vector<DiskRequest *> &done, const SIZE_T min)
+{
+  ERROR_T rc = ERROR_NOERROR;
+
+  while (completed.size()<min && outstanding>0 && rc==ERROR_NOERROR) { 
+    rc = Collect();
+  }
+  done.insert(done.end(),completed.begin(),completed.end());
+  completed.clear();
+  return rc;
+}
+
+SIZE_T DiskSystem::GetNumOutstanding() const
+{
+  return outstanding+completed.size();
+}
+
+ERROR_T DiskSystem::ReadData(const SIZE_T blocknum, BYTE_T *buf)
+{
+  SIZE_T off = offset+blocknum*blocksize;
+  SIZE_T n;
+
+  switch (iomode) { 
+  case DISK_IO_MMAP:
+    memcpy(buf,datamap+off,blocksize);
+    return ERROR_NOERROR;
+  case DISK_IO_DIRECT:
+    if ((uintptr_t)buf%DIRECT_IO_ALIGN==0) { 
+      n=myread(directfd,off,buf,blocksize,true);
+    } else {
+      n=myread(directfd,off,bouncebuf,blocksize,true);
+      memcpy(buf,bouncebuf,blocksize);
+    }
+    break;
+  default:
+    n=myread(datafd,off,buf,blocksize,true);
+    break;
+  }
+  if (n!=blocksize) { 
+    cerr << "DiskSystem::Read: myread has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::WriteData(const SIZE_T blocknum, const BYTE_T *buf)
+{
+  SIZE_T off = offset+blocknum*blocksize;
+  SIZE_T n;
+
+  switch (iomode) { 
+  case DISK_IO_MMAP:
+    memcpy(datamap+off,buf,blocksize);
+    return ERROR_NOERROR;
+  case DISK_IO_DIRECT:
+    if ((uintptr_t)buf%DIRECT_IO_ALIGN==0) { 
+      n=mywrite(directfd,off,buf,blocksize);
+    } else {
+      memcpy(bouncebuf,buf,blocksize);
+      n=mywrite(directfd,off,bouncebuf,blocksize);
+    }
+    break;
+  default:
+    n=mywrite(datafd,off,buf,blocksize);
+    break;
+  }
+  if (n!=blocksize) {  
+    cerr << "DiskSystem::Write: mywrite has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+  return ERROR_NOERROR;
+}
+
+
+double DiskSystem::SeekAndRotation(const SIZE_T offblock) const
+{
   SIZE_T req_trackstart = (offblock) / (numheads*blockspertrack);
   SIZE_T req_sectorstart=  (offblock) % (numheads*blockspertrack);
 
-  SIZE_T req_trackend = (offblock+numblock-1) / (numheads*blockspertrack);
-  SIZE_T req_sectorend=  (offblock+numblock-1) % (numheads*blockspertrack);
-
   SIZE_T trackhop = (SIZE_T) fabs((double)req_trackstart-(double)last_track);
   double trackhopfrac = (double)trackhop/(double)numtracks;
 
@@ -397,6 +1027,37 @@ double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock)
   double sectorhopfrac = (double)sectorhop/(double)blockspertrack;
   double timeinrotation=rotationallatency*sectorhopfrac;
 
+  return timeinseek+timeinrotation;
+}
+
+double DiskSystem::PositioningTime(const SIZE_T offblock, const bool write,
+				   const double at) const
+{
+  return SeekAndRotation(offblock);
+}
+
+double DiskSystem::Issue(const SIZE_T offblock, const bool write,
+			 const double at, double &finish)
+{
+  finish=at+ModelAccess(offblock,1,write);
+  return finish;
+}
+
+//
+// Note, this assumes disk is kept continously busy
+// or that time does not advance except during a disk op
+//
+double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock,
+			       const bool write) 
+{
+
+  SIZE_T req_trackstart = (offblock) / (numheads*blockspertrack);
+
+  SIZE_T req_trackend = (offblock+numblock-1) / (numheads*blockspertrack);
+  SIZE_T req_sectorend=  (offblock+numblock-1) % (numheads*blockspertrack);
+
+  double timetostart=SeekAndRotation(offblock);
+
   // Now we've got to read numblockelements
 
   // The number of side by side tracks we'll deal with:
@@ -409,7 +1070,7 @@ double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock)
   last_track=req_trackend;
   last_sector=req_sectorend;
 
-  return timeinseek+timeinrotation+timeintrackbytrackhops+timeinreadsectors;
+  return timetostart+timeintrackbytrackhops+timeinreadsectors;
 }
 
 
@@ -425,29 +1086,67 @@ ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  // blocks that are already the right size are read into in place
+  blocks.resize(numblock);
+  runbufs.resize(numblock);
+  for (SIZE_T i=0;i<numblock;i++) { 
+    Block &b=blocks[i];
+    if (b.Resize(blocksize,false)!=ERROR_NOERROR) { 
+      return ERROR_NOMEM;
+    }
+    runbufs[i]=b.data;
+  }
+
+  return ReadV(inoffblock,numblock,numblock ? &runbufs[0] : 0,reqtime);
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  const vector<Block> &blocks,
+			  double        &reqtime)
+{
+  reqtime=0;
+
+  if (blocks.size()<numblock) { 
+    return ERROR_SIZE;
+  }
+  runbufs.resize(numblock);
+  for (SIZE_T i=0;i<numblock;i++) { 
+    runbufs[i]=blocks[i].data;
+  }
+
+  return WriteV(inoffblock,numblock,numblock ? &runbufs[0] : 0,reqtime);
+}
+
+ERROR_T DiskSystem::ReadV(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  BYTE_T * const *bufs,
+			  double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  reqtime=ModelAccess(inoffblock,numblock,false);
 
   for (SIZE_T i=0;i<numblock;i++) { 
-    Block b(blocksize);
     if (!IsBlockAllocated(inoffblock+i)) { 
       if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
 	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (myread(datafilefd,offset+(inoffblock+i)*blocksize,b.data,blocksize,true)!=blocksize) { 
-      cerr << "DiskSystem::Read: myread has failed"<<endl;
-      return ERROR_IMPLBUG;
-    }
-    blocks.push_back(b);
   }
 
-  return ERROR_NOERROR;
+  return TransferRun(inoffblock,numblock,bufs,false);
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
-			  const SIZE_T   numblock,
-			  const vector<Block> &blocks,
-			  double        &reqtime)
+ERROR_T DiskSystem::WriteV(const SIZE_T   inoffblock,
+			   const SIZE_T   numblock,
+			   BYTE_T * const *bufs,
+			   double        &reqtime)
 {
   reqtime=0;
 
@@ -456,7 +1155,7 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  reqtime=ModelAccess(inoffblock,numblock,true);
 
   for (SIZE_T i=0;i<numblock;i++) { 
     if (!IsBlockAllocated(inoffblock+i)) { 
@@ -464,44 +1163,55 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
 	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (mywrite(datafilefd,offset+(inoffblock+i)*blocksize,blocks[i].data,blocksize)!=blocksize) {  
-      cerr << "DiskSystem::Write: mywrite has failed"<<endl;
-      return ERROR_IMPLBUG;
-    }
   }
 
-  return ERROR_NOERROR;
+  return TransferRun(inoffblock,numblock,bufs,true);
 }
 
 
-ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
+// The single block versions go straight to and from the caller's
+// block, so a block that is already the right size costs no copies
+// or allocations
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &block, double &reqtime)
 {
-  vector<Block> bl;
+  reqtime=0;
 
-  ERROR_T rc = Read(inoffblock,1,bl,reqtime);
+  if (inoffblock >= numblocks) { 
+    cerr << "DiskSystem::Read: Attempt to read block "<<inoffblock<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  if (block.Resize(blocksize,false)!=ERROR_NOERROR) { 
+    return ERROR_NOMEM;
   }
 
-  blocks = bl[0];
+  reqtime=ModelAccess(inoffblock,1,false);
 
-  return ERROR_NOERROR;
+  if (!IsBlockAllocated(inoffblock)) { 
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+      cerr <<"DiskSystem::Read: reading unallocated block "<<inoffblock<<endl;
+    }
+  }
+  return ReadData(inoffblock,block.data);
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &block, double &reqtime)
 {
-  vector<Block> bl;
+  reqtime=0;
 
-  bl.push_back(blocks);
+  if (inoffblock >= numblocks) { 
+    cerr << "DiskSystem::Write: Attempt to write block "<<inoffblock<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
 
-  ERROR_T rc = Write(inoffblock,1,bl,reqtime);
+  reqtime=ModelAccess(inoffblock,1,true);
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  if (!IsBlockAllocated(inoffblock)) { 
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+      cerr <<"DiskSystem::Write: writing unallocated block "<<inoffblock<<endl;
+    }
   }
-
-  return ERROR_NOERROR;
+  return WriteData(inoffblock,block.data);
 }
 
 
@@ -515,16 +1225,88 @@ SIZE_T DiskSystem::GetNumBlocks() const
   return numblocks;
 }
 
+SIZE_T DiskSystem::GetHeadBlock() const
+{
+  return last_track*numheads*blockspertrack+last_sector;
+}
+
+void DiskSystem::SetQueueDepth(const SIZE_T depth)
+{
+  queuedepth = depth<1 ? 1 : depth;
+}
+
+SIZE_T DiskSystem::GetQueueDepth() const
+{
+  return queuedepth;
+}
 
+const string &DiskSystem::GetFileStem() const
+{
+  return diskfilestem;
+}
+
+const string &DiskSystem::GetModel() const
+{
+  return model;
+}
+
+double DiskSystem::GetWriteAmplification() const
+{
+  return 1;
+}
+
+double DiskSystem::GetModelParam(const string &name, const double dflt) const
+{
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    if (modelparams[i].first==name) { 
+      return modelparams[i].second;
+    }
+  }
+  return dflt;
+}
+
+void DiskSystem::SetModelParam(const string &name, const double value)
+{
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    if (modelparams[i].first==name) { 
+      modelparams[i].second=value;
+      return;
+    }
+  }
+  modelparams.push_back(make_pair(name,value));
+}
+
+DiskSystem *DiskSystem::Open(const string &filestem)
+{
+  FILE  *f;
+  char   buf[80];
+  string model;
+
+  // the model follows its comment near the end of the config file
+  if ((f=fopen((filestem+".config").c_str(),"r"))) { 
+    while (fgets(buf,80,f)) { 
+      if (!strcmp(buf,"# model\n")) { 
+	if (fgets(buf,80,f)) { 
+	  buf[strcspn(buf,"\n")]=0;
+	  model=string(buf);
+	}
+	break;
+      }
+    }
+    fclose(f);
+  }
+
+  if (model=="flash") { 
+    return new FlashDisk(filestem);
+  }
+  return new DiskSystem(filestem);
+}
 
-#define GETBIT(x) ((bitmap[(x)/8] >> (7-((x)%8))) & 0x1)
-#define SETBIT(x) do { bitmap[(x)/8] |= 0x1 << (7-((x)%8)); } while (0)
-#define CLEARBIT(x) do { bitmap[(x)/8] &= ~(0x1 << (7-((x)%8))); } while (0)
 
 
 bool DiskSystem::IsBlockAllocated(const SIZE_T block)
 {
-  return GETBIT(block);
+  return allocator.IsSet(block);
 }
 
 
@@ -536,13 +1318,8 @@ ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innum
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr << "Disksystem: NotifyAllocateBlocks: Block "<<i<<" is being allocated, but it's already allocated!"<<endl;
-      }
-    }
-    SETBIT(i);
+  if (allocator.Set(offset,innumblocks)>0 && PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    cerr << "Disksystem: NotifyAllocateBlocks: Blocks "<<offset<<" to "<<(offset+innumblocks-1)<<" are being allocated, but some are already allocated!"<<endl;
   }
 
   return ERROR_NOERROR;
@@ -556,22 +1333,32 @@ ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset,const SIZE_T innu
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (!IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-	cerr << "Disksystem: NotifyDeallocateBlocks: Block "<<i<<" is being deallocated, but it's already deallocated!"<<endl;
-      }
-    }
-    CLEARBIT(i);
+  if (allocator.Clear(offset,innumblocks)>0 && PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    cerr << "Disksystem: NotifyDeallocateBlocks: Blocks "<<offset<<" to "<<(offset+innumblocks-1)<<" are being deallocated, but some are already deallocated!"<<endl;
   }
 
   return ERROR_NOERROR;
 }
 
+ERROR_T DiskSystem::AllocateBlocks(const SIZE_T num, const SIZE_T hint, SIZE_T &first)
+{
+  if (!allocator.Find(num,hint,first)) { 
+    return ERROR_NOSPACE;
+  }
+  allocator.Set(first,num);
+  return ERROR_NOERROR;
+}
+
+SIZE_T DiskSystem::GetNumFreeBlocks() const
+{
+  return allocator.GetNumFree();
+}
+
 
 ostream & DiskSystem::Print(ostream &os) const
 {
   os << "DiskSystem(diskfilestem="<<diskfilestem
+     << ", model="<<model
      << ", offset="<<offset
      << ", numblocks="<<numblocks
      << ", blocksize="<<blocksize
@@ -583,10 +1370,21 @@ ostream & DiskSystem::Print(ostream &os) const
      << ", averageseeklatency="<<averageseeklatency
      << ", trackseeklatency="<<trackseeklatency
      << ", rotationallatency="<<rotationallatency
-     << ", bitmap=";
+     << ", queuedepth="<<queuedepth
+     << ", numfree="<<allocator.GetNumFree()
+     << ", io=";
+
+  switch (iomode) { 
+  case DISK_IO_DIRECT: os << "direct"; break;
+  case DISK_IO_MMAP: os << "mmap"; break;
+  case DISK_IO_ASYNC: os << "async(" << aio->GetName() << ")"; break;
+  default: os << "pread"; break;
+  }
+
+  os << ", bitmap=";
 
   for (SIZE_T i=0;i<numblocks;i++) { 
-    if (GETBIT(i)) { 
+    if (allocator.IsSet(i)) { 
       os <<"*";
     } else {
       os <<".";
@@ -1,16 +1,55 @@
 #ifndef _disksystem
 #define _disksystem
 
+#include <sys/uio.h>
+
 #include <string>
 #include <iostream>
 #include <vector>
+#include <utility>
 
 #include "global.h"
 #include "block.h"
+#include "asyncio.h"
+#include "bitmapalloc.h"
 
 using namespace std;
 
-// Models a single disk with a single outstanding request
+// How a DiskSystem moves data to and from its files
+//
+// DISK_IO_PREAD reads and writes each block with pread and pwrite.
+// DISK_IO_DIRECT does the same through a second descriptor opened
+// with O_DIRECT, bypassing the kernel's page cache; buffers that
+// aren't aligned go through an aligned bounce buffer.  DISK_IO_MMAP
+// maps the data and bitmap files, so a block is read or written with
+// a memcpy.  DISK_IO_ASYNC hands the requests given to Submit to an
+// AsyncIO engine, so they are in flight together.  Simulated time is
+// the same in every mode.
+//
+// Except when mapped, a run of blocks moves in one preadv or pwritev.
+enum DiskIOMode {DISK_IO_PREAD, DISK_IO_DIRECT, DISK_IO_MMAP, DISK_IO_ASYNC};
+
+// A block transfer for DiskSystem::Submit and Reap
+struct DiskRequest {
+  SIZE_T         blocknum;
+  Block         *block;    // reads resize it to the block size
+  bool           write;
+  double         issue;    // simulated time it reaches the disk, set by the caller
+  double         reqtime;  // simulated time the disk spends on it, set by Submit
+  double         finish;   // simulated time it completes, set by Submit
+  ERROR_T        rc;       // set by the time it is reaped
+  void          *tag;      // the caller's
+  AsyncIORequest io;       // the engine's
+};
+
+// Models a single disk with a single outstanding request, or, for
+// the requests given to Submit, with a queue of them (see
+// SetQueueDepth)
+//
+// This class models a spinning disk, with seeks and rotation.
+// Subclasses model other devices (see FlashDisk) by overriding
+// ModelAccess, PositioningTime and Issue; the config file names the
+// model a disk was made with, and Open builds the right one.
 //
 // Includes storage allocator and free space bitmap to 
 // simplify project - REAL DISKS DO NOT HAVE ALLOCATORS OR BITMAPS
@@ -18,9 +57,10 @@ using namespace std;
 class DiskSystem {
  private:
   BYTE_T *bitmap;
-  FILE*  datafilefd;
+  BitMapAllocator allocator; // over bitmap, wherever it is
+  int    datafd;
   FILE*  configfilefd;
-  FILE*  bitmapfilefd;
+  int    bitmapfd;
 
 
   //
@@ -41,16 +81,96 @@ class DiskSystem {
   double trackseeklatency;
   double rotationallatency;
 
+  // "disk", or a subclass's, with the subclass's parameters by name
+  string model;
+  vector<pair<string,double> > modelparams;
+
+  SIZE_T queuedepth;
+  vector<DiskRequest *> devqueue;  // scratch for Schedule: held by the disk
+  vector<double>        inservice; // and finishing times of those started
+
+  DiskIOMode iomode;
+  BYTE_T    *datamap;      // the data file, mapped from its start
+  size_t     datamaplen;
+  bool       bitmapmapped; // bitmap is the bitmap file, mapped private
+  bool       bitmapshared; // or shared, so the mapping is the file
+  int        directfd;     // the data file opened O_DIRECT, or -1
+  BYTE_T    *bouncebuf;    // aligned, for direct I/O from unaligned blocks
+  SIZE_T     bouncesize;
+
+  AsyncIO   *aio;          // in DISK_IO_ASYNC mode
+  SIZE_T     outstanding;  // handed to aio and not finished
+  vector<DiskRequest *>    completed;  // finished and not reaped
+  vector<DiskRequest *>    ready;      // scratch for Schedule and Start
+  vector<AsyncIORequest *> aioscratch; // and for Dispatch and Collect
+
+  // scratch for runs; they only grow
+  vector<BYTE_T *>         runbufs;
+  vector<struct iovec>     iov;
+
  protected:
-  virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
+  // Time to reach block off from the head's position
+  double SeekAndRotation(const SIZE_T off) const;
+
+  // Milliseconds to move num blocks from off, the disk being idle
+  virtual double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+  // Milliseconds from at until a request for block off could start
+  // transferring, without changing anything; here, the seek and
+  // rotation from the head's position
+  virtual double PositioningTime(const SIZE_T off, const bool write, const double at) const;
+  // Starts a one block request at time at and sets finish to when it
+  // completes
+  // returns the time the disk can start another; here, finish
+  virtual double Issue(const SIZE_T off, const bool write, const double at, double &finish);
+
+  // For subclasses: makes a disk of another model, which is recorded
+  // in the config file.  The seek and rotation parameters are unused
+  // by other models and may be 0.
+  DiskSystem(const string &model,
+	     const string &filestem,
+	     const bool create,
+	     const SIZE_T offset,
+	     const SIZE_T blocks,
+	     const SIZE_T blocksize,
+	     const SIZE_T heads,
+	     const SIZE_T blockspertrack,
+	     const SIZE_T tracks,
+	     const double avgseek,
+	     const double trackseek,
+	     const double rotlat);
+  // A model parameter from the config file, or dflt if it has none
+  double GetModelParam(const string &name, const double dflt) const;
+  // Sets one for the config file, which WriteConfig saves
+  void   SetModelParam(const string &name, const double value);
 
   ERROR_T SanityCheckConfig();
   ERROR_T InitFromConfigFile();
   ERROR_T InitFromInMemoryConfig();
   ERROR_T ReadConfig();
   ERROR_T WriteConfig();
+  // Maps the bitmap file, private, so its pages are read as they are
+  // touched; if it can't be mapped, reads all of it
   ERROR_T ReadBitMap();
+  // Writes back the pages of the bitmap that have changed
   ERROR_T WriteBitMap();
+  void    ReleaseBitMap();
+  SIZE_T  NumBitMapBytes() const;
+  ERROR_T MapFiles();
+  void    UnmapFiles();
+  ERROR_T OpenDirect();
+  void    CloseDirect();
+  ERROR_T GrowBounce(const SIZE_T bytes);
+  void    StopAsync();
+  // Starts transfers without charging time
+  ERROR_T Dispatch(DiskRequest **reqs, const SIZE_T n);
+  // Waits for at least one transfer from the engine
+  ERROR_T Collect();
+  // Moves a run of blocks between the data file and bufs
+  ERROR_T TransferRun(const SIZE_T first, const SIZE_T n,
+		      BYTE_T * const *bufs, const bool write);
+  // Copy one block between the data file and memory
+  ERROR_T ReadData(const SIZE_T blocknum, BYTE_T *buf);
+  ERROR_T WriteData(const SIZE_T blocknum, const BYTE_T *buf);
   
    
  public:
@@ -68,6 +188,10 @@ class DiskSystem {
 	     const double avgseek=0,
 	     const double trackseek=0,
 	     const double rotlat=0);
+  // Opens an existing disk as the model its config file names
+  // returns a new disk for the caller to delete
+  static DiskSystem *Open(const string &filestem);
+
   DiskSystem() { throw GenericException(); } 
   DiskSystem(const DiskSystem &rhs) { throw GenericException();}
   DiskSystem & operator=(const DiskSystem &rhs) { throw GenericException(); return *this;}
@@ -76,6 +200,7 @@ class DiskSystem {
 
   // Each returns the number of milliseconds the operation has taken
 
+  // blocks ends up numblock long
   ERROR_T Read(const SIZE_T inoffblock,
 	       const SIZE_T numblock,
 	       vector<Block> &blocks,
@@ -94,8 +219,76 @@ class DiskSystem {
 		const Block &blocks,
 		double &reqtime);
 
+  // Scatter/gather versions: block inoffblock+i moves to or from
+  // bufs[i], which holds GetBlockSize() bytes.  A run costs one
+  // preadv or pwritev, and no allocation once the disk has seen a
+  // run as long.
+  ERROR_T ReadV(const SIZE_T inoffblock,
+		const SIZE_T numblock,
+		BYTE_T * const *bufs,
+		double &reqtime);
+
+  ERROR_T WriteV(const SIZE_T inoffblock,
+		 const SIZE_T numblock,
+		 BYTE_T * const *bufs,
+		 double &reqtime);
+
+  // Submit plays the requests through the disk's command queue in
+  // simulated time and starts the transfers.  The disk is free from
+  // start; requests join its queue in the order given, each no
+  // earlier than its issue time, and up to the queue depth wait
+  // there at once.  Whenever it finishes one the disk serves the
+  // queued request it can reach soonest, so reqtime is that
+  // request's own positioning and transfer time and finish is when
+  // it completes.  With a depth of 1 they are served in order, as
+  // single block Reads and Writes would be.
+  //
+  // In DISK_IO_ASYNC mode the transfers then run together; in the
+  // other modes they are done before Submit returns.  Requests and
+  // their blocks must stay put until reaped.
+  // returns ERROR_NOERROR or ERROR_GENERAL if the engine fails;
+  // each request's own error is in its rc
+  ERROR_T Submit(DiskRequest **reqs, const SIZE_T n, const double start=0);
+  // Submit in two steps.  Schedule does its simulated part: it sets
+  // each request's rc, reqtime and finish and moves the head, but
+  // moves no data.  Start then transfers the requests Schedule gave,
+  // whenever the caller likes, so the simulated times don't depend
+  // on when that is.  Other requests may be scheduled in between;
+  // requests are started in the order they were scheduled.
+  void    Schedule(DiskRequest **reqs, const SIZE_T n, const double start=0);
+  ERROR_T Start(DiskRequest **reqs, const SIZE_T n);
+  // Waits until at least min submitted requests (no more than are
+  // outstanding) have finished and appends every finished one to done
+  ERROR_T Reap(vector<DiskRequest *> &done, const SIZE_T min);
+  // Submitted and not yet reaped
+  SIZE_T  GetNumOutstanding() const;
+
   SIZE_T GetBlockSize() const;
   SIZE_T GetNumBlocks() const;
+  // The block under the head after the last request
+  SIZE_T GetHeadBlock() const;
+
+  // Requests Submit lets the disk hold and reorder at once (default
+  // 1, no reordering)
+  void   SetQueueDepth(const SIZE_T depth);
+  SIZE_T GetQueueDepth() const;
+
+  // Switches to another way of reaching the files; see DiskIOMode
+  // returns ERROR_NOERROR, ERROR_BADCONFIG if the offset or block
+  // size don't suit O_DIRECT, or ERROR_NOFILE or ERROR_NOMEM if the
+  // files can't be opened or mapped, leaving the mode as it was
+  ERROR_T SetIOMode(const DiskIOMode mode);
+  DiskIOMode GetIOMode() const;
+  // Maps "pread", "direct", "mmap" or "async" to a mode
+  // returns ERROR_NOERROR or ERROR_BADCONFIG
+  static ERROR_T ParseIOMode(const char *name, DiskIOMode &mode);
+  // The stem the disk's files are named after
+  const string &GetFileStem() const;
+  // The model the disk was made with, "disk" for this class
+  const string &GetModel() const;
+  // Pages the device wrote for each block written to it; always 1
+  // for a spinning disk
+  virtual double GetWriteAmplification() const;
 
   //
   // These are notification functions that should be called when
@@ -109,10 +302,37 @@ class DiskSystem {
 
   bool    IsBlockAllocated(const SIZE_T offset);
 
+  // Finds num free blocks in a row, at or after hint if it can
+  // (otherwise anywhere), and allocates them
+  // returns ERROR_NOERROR with first set, or ERROR_NOSPACE if there
+  // is no such run
+  ERROR_T AllocateBlocks(const SIZE_T num, const SIZE_T hint, SIZE_T &first);
+  SIZE_T  GetNumFreeBlocks() const;
 
-  ostream & Print(ostream &os) const;
+
+  virtual ostream & Print(ostream &os) const;
 };
 
 inline ostream & operator<< (ostream &os, const DiskSystem &rhs) { return rhs.Print(os);}
 
+
+//
+// Opens a disk for the length of a scope, as the model its config
+// file names, and closes it at the end
+//
+class ScopedDisk {
+ private:
+  DiskSystem *disk;
+
+  ScopedDisk(const ScopedDisk &rhs);
+  ScopedDisk & operator=(const ScopedDisk &rhs);
+ public:
+  ScopedDisk(const string &filestem) : disk(DiskSystem::Open(filestem)) {}
+  ~ScopedDisk() { delete disk; }
+
+  DiskSystem *get() const { return disk; }
+  DiskSystem *operator->() const { return disk; }
+  DiskSystem &operator*() const { return *disk; }
+};
+
 #endif
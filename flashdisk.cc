@@ -0,0 +1,324 @@
+#include <math.h>
+
+#include "flashdisk.h"
+
+
+// Defaults for parameters missing from the config file
+#define FLASH_PAGES_PER_BLOCK   64
+#define FLASH_CHANNELS          4
+#define FLASH_DIES_PER_CHANNEL  2
+#define FLASH_READ_LATENCY      0.05
+#define FLASH_PROGRAM_LATENCY   0.5
+#define FLASH_ERASE_LATENCY     3
+#define FLASH_TRANSFER_LATENCY  0.01
+#define FLASH_OVERPROVISION     7
+
+// Free erase blocks a die keeps back to copy valid pages into
+#define FLASH_GC_RESERVE        1
+
+#define FLASH_NONE              ((SIZE_T)-1)
+
+
+FlashDisk::FlashDisk(const string &filestem) :
+  DiskSystem(filestem)
+{
+  Setup();
+}
+
+FlashDisk::FlashDisk(const string &filestem,
+		     const SIZE_T offset,
+		     const SIZE_T blocks,
+		     const SIZE_T blocksize,
+		     const SIZE_T pagesperblock,
+		     const SIZE_T channels,
+		     const SIZE_T diesperchannel,
+		     const double readlat,
+		     const double programlat,
+		     const double eraselat,
+		     const double transferlat,
+		     const double overprovision) :
+  // as a disk, one head with an erase block to a track
+  DiskSystem("flash",filestem,true,offset,blocks,blocksize,
+	     1,pagesperblock,pagesperblock ? blocks/pagesperblock : 0,0,0,0)
+{
+  SetModelParam("pagesperblock",pagesperblock);
+  SetModelParam("channels",channels);
+  SetModelParam("diesperchannel",diesperchannel);
+  SetModelParam("readlatency",readlat);
+  SetModelParam("programlatency",programlat);
+  SetModelParam("eraselatency",eraselat);
+  SetModelParam("transferlatency",transferlat);
+  SetModelParam("overprovision",overprovision);
+  WriteConfig();
+  Setup();
+}
+
+void FlashDisk::Setup()
+{
+  pagesperblock=(SIZE_T)GetModelParam("pagesperblock",FLASH_PAGES_PER_BLOCK);
+  numchannels=(SIZE_T)GetModelParam("channels",FLASH_CHANNELS);
+  diesperchannel=(SIZE_T)GetModelParam("diesperchannel",FLASH_DIES_PER_CHANNEL);
+  readlatency=GetModelParam("readlatency",FLASH_READ_LATENCY);
+  programlatency=GetModelParam("programlatency",FLASH_PROGRAM_LATENCY);
+  eraselatency=GetModelParam("eraselatency",FLASH_ERASE_LATENCY);
+  transferlatency=GetModelParam("transferlatency",FLASH_TRANSFER_LATENCY);
+  overprovision=GetModelParam("overprovision",FLASH_OVERPROVISION);
+
+  if (pagesperblock<1 || numchannels<1 || diesperchannel<1 ||
+      readlatency<=0 || programlatency<=0 || eraselatency<=0 ||
+      transferlatency<0 || overprovision<0) {
+    cerr << "Impossible flash performance.\n";
+    if (pagesperblock<1) { pagesperblock=1; }
+    if (numchannels<1) { numchannels=1; }
+    if (diesperchannel<1) { diesperchannel=1; }
+  }
+
+  // Each die holds its share of the blocks, spare erase blocks to
+  // make writing them cheap, and the reserve
+  SIZE_T numblocks=GetNumBlocks();
+  numdies=numchannels*diesperchannel;
+  SIZE_T perdie=(numblocks+numdies-1)/numdies;
+  SIZE_T used=(perdie+pagesperblock-1)/pagesperblock;
+  blocksperdie=(SIZE_T)ceil(used*(1+overprovision/100));
+  if (blocksperdie<used+1) {
+    blocksperdie=used+1;
+  }
+  blocksperdie+=FLASH_GC_RESERVE;
+
+  SIZE_T numerase=numdies*blocksperdie;
+
+  l2p.assign(numblocks,FLASH_NONE);
+  p2l.assign(numerase*pagesperblock,FLASH_NONE);
+  validpages.assign(numerase,0);
+  writeptr.assign(numerase,0);
+  active.assign(numdies,FLASH_NONE);
+  freeblocks.assign(numdies,vector<SIZE_T>());
+  diefree.assign(numdies,0);
+  channelfree.assign(numchannels,0);
+
+  // block i goes on die i%numdies, so a run reads from every die
+  for (SIZE_T i=0;i<numblocks;i++) {
+    SIZE_T die=i%numdies;
+    SIZE_T n=i/numdies;
+    SIZE_T eb=die*blocksperdie+n/pagesperblock;
+    SIZE_T page=eb*pagesperblock+n%pagesperblock;
+    l2p[i]=page;
+    p2l[page]=i;
+    validpages[eb]++;
+    writeptr[eb]=n%pagesperblock+1;
+  }
+  // the rest are free, lowest on top
+  for (SIZE_T die=0;die<numdies;die++) {
+    for (SIZE_T eb=(die+1)*blocksperdie;eb>die*blocksperdie;eb--) {
+      if (writeptr[eb-1]==0) {
+	freeblocks[die].push_back(eb-1);
+      }
+    }
+  }
+
+  nextdie=0;
+  reads=writes=programs=erases=0;
+}
+
+SIZE_T FlashDisk::DieOf(const SIZE_T page) const
+{
+  return page/pagesperblock/blocksperdie;
+}
+
+SIZE_T FlashDisk::Turn(const SIZE_T die) const
+{
+  return (die+numdies-nextdie)%numdies;
+}
+
+void FlashDisk::Program(const SIZE_T block, const SIZE_T die)
+{
+  SIZE_T old=l2p[block];
+  SIZE_T eb=active[die];
+  SIZE_T page=eb*pagesperblock+writeptr[eb];
+
+  if (old!=FLASH_NONE) {
+    validpages[old/pagesperblock]--;
+    p2l[old]=FLASH_NONE;
+  }
+  writeptr[eb]++;
+  validpages[eb]++;
+  l2p[block]=page;
+  p2l[page]=block;
+  programs++;
+}
+
+bool FlashDisk::MakeRoom(const SIZE_T die, double &gctime)
+{
+  if (active[die]!=FLASH_NONE && writeptr[active[die]]<pagesperblock) {
+    return true;
+  }
+  active[die]=FLASH_NONE;
+  if (freeblocks[die].size()>FLASH_GC_RESERVE) {
+    active[die]=freeblocks[die].back();
+    freeblocks[die].pop_back();
+    return true;
+  }
+
+  // Greedy: the written erase block with the fewest valid pages
+  SIZE_T victim=FLASH_NONE;
+  for (SIZE_T eb=die*blocksperdie;eb<(die+1)*blocksperdie;eb++) {
+    if (writeptr[eb]>0 &&
+	(victim==FLASH_NONE || validpages[eb]<validpages[victim])) {
+      victim=eb;
+    }
+  }
+  if (victim==FLASH_NONE || validpages[victim]>=pagesperblock) {
+    return false;
+  }
+
+  // copy its valid pages into the reserve, which has room for them
+  // and more, then erase it to be the new reserve
+  active[die]=freeblocks[die].back();
+  freeblocks[die].pop_back();
+  for (SIZE_T i=0;i<writeptr[victim];i++) {
+    SIZE_T page=victim*pagesperblock+i;
+    if (p2l[page]!=FLASH_NONE) {
+      Program(p2l[page],die);
+      gctime+=readlatency+programlatency;
+    }
+  }
+  writeptr[victim]=0;
+  freeblocks[die].push_back(victim);
+  gctime+=eraselatency;
+  erases++;
+  return true;
+}
+
+double FlashDisk::PositioningTime(const SIZE_T off, const bool write,
+				  const double at) const
+{
+  double free;
+
+  if (!write) {
+    free=diefree[DieOf(l2p[off])];
+  } else {
+    free=diefree[0];
+    for (SIZE_T die=1;die<numdies;die++) {
+      if (diefree[die]<free) {
+	free=diefree[die];
+      }
+    }
+  }
+  return free>at ? free-at : 0;
+}
+
+double FlashDisk::Issue(const SIZE_T off, const bool write,
+			const double at, double &finish)
+{
+  double start;
+
+  if (!write) {
+    SIZE_T die=DieOf(l2p[off]);
+    SIZE_T channel=die%numchannels;
+
+    start=(diefree[die]>at ? diefree[die] : at)+readlatency;
+    if (channelfree[channel]>start) {
+      start=channelfree[channel];
+    }
+    finish=start+transferlatency;
+    diefree[die]=channelfree[channel]=finish;
+    reads++;
+    return at;
+  }
+
+  // Try the dies from the one free soonest until one has room.
+  // Among equals they take turns, so the pages written spread evenly.
+  SIZE_T die=FLASH_NONE;
+  SIZE_T last=FLASH_NONE;
+  double gctime=0;
+
+  for (SIZE_T tries=0;tries<numdies && die==FLASH_NONE;tries++) {
+    SIZE_T next=FLASH_NONE;
+    for (SIZE_T d=0;d<numdies;d++) {
+      if (last!=FLASH_NONE &&
+	  (diefree[d]<diefree[last] ||
+	   (diefree[d]==diefree[last] && Turn(d)<=Turn(last)))) {
+	continue;
+      }
+      if (next==FLASH_NONE || diefree[d]<diefree[next] ||
+	  (diefree[d]==diefree[next] && Turn(d)<Turn(next))) {
+	next=d;
+      }
+    }
+    if (MakeRoom(next,gctime)) {
+      die=next;
+    }
+    last=next;
+  }
+  if (die==FLASH_NONE) {
+    // every page valid and no spares: can't happen with any spare
+    finish=at;
+    return at;
+  }
+
+  SIZE_T channel=die%numchannels;
+
+  nextdie=(die+1)%numdies;
+
+  // collecting garbage keeps the die busy first
+  if (gctime>0) {
+    diefree[die]=(diefree[die]>at ? diefree[die] : at)+gctime;
+  }
+  start=(channelfree[channel]>at ? channelfree[channel] : at)+transferlatency;
+  channelfree[channel]=start;
+  if (diefree[die]>start) {
+    start=diefree[die];
+  }
+  finish=start+programlatency;
+  diefree[die]=finish;
+  Program(off,die);
+  writes++;
+  return at;
+}
+
+//
+// The disk is idle when a request arrives, but its pages are spread
+// over the dies and move in parallel
+//
+double FlashDisk::ModelAccess(const SIZE_T off, const SIZE_T num, const bool write)
+{
+  double done=0;
+  double finish;
+
+  diefree.assign(numdies,0);
+  channelfree.assign(numchannels,0);
+  for (SIZE_T i=0;i<num;i++) {
+    Issue(off+i,write,0,finish);
+    if (finish>done) {
+      done=finish;
+    }
+  }
+  return done;
+}
+
+double FlashDisk::GetWriteAmplification() const
+{
+  return writes>0 ? (double)programs/(double)writes : 1;
+}
+
+ostream & FlashDisk::Print(ostream &os) const
+{
+  os << "FlashDisk(pagesperblock="<<pagesperblock
+     << ", channels="<<numchannels
+     << ", diesperchannel="<<diesperchannel
+     << ", readlatency="<<readlatency
+     << ", programlatency="<<programlatency
+     << ", eraselatency="<<eraselatency
+     << ", transferlatency="<<transferlatency
+     << ", overprovision="<<overprovision
+     << ", blocksperdie="<<blocksperdie
+     << ", reads="<<reads
+     << ", writes="<<writes
+     << ", programs="<<programs
+     << ", erases="<<erases
+     << ", writeamplification="<<GetWriteAmplification()
+     << ", disk=";
+  DiskSystem::Print(os);
+  os << ")";
+  return os;
+}
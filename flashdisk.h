@@ -0,0 +1,100 @@
+#ifndef _flashdisk
+#define _flashdisk
+
+#include <vector>
+
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// Models a flash drive behind the DiskSystem interface
+//
+// Each block is a flash page.  Pages are programmed in order into
+// erase blocks pagesperblock long, and an erase block has to be
+// erased as a whole before any of its pages can be programmed again.
+// The erase blocks are spread over channels*diesperchannel dies,
+// which work in parallel.  Reading a page keeps its die busy for the
+// read latency and then its channel for the transfer; programming
+// one uses the channel and then the die for the program latency.
+//
+// A page mapped flash translation layer (FTL) writes each page to
+// the die that can take it soonest and marks the old copy invalid.
+// When a die is down to its last free erase block it collects
+// garbage: it copies the valid pages out of its erase block with the
+// fewest and erases that.  The spare erase blocks, overprovision
+// percent beyond what the blocks need, keep the copying down; the
+// pages programmed for each block written are the write
+// amplification.
+//
+// The mapping is kept in memory only, and starts afresh, with the
+// blocks striped page by page across the dies, each time the disk
+// is opened.
+//
+class FlashDisk : public DiskSystem {
+ private:
+  SIZE_T pagesperblock;
+  SIZE_T numchannels;
+  SIZE_T diesperchannel;
+  double readlatency;
+  double programlatency;
+  double eraselatency;
+  double transferlatency;
+  double overprovision;
+
+  SIZE_T numdies;
+  SIZE_T blocksperdie;          // erase blocks
+  vector<SIZE_T> l2p;           // block to page
+  vector<SIZE_T> p2l;           // page to block, or none
+  vector<SIZE_T> validpages;    // per erase block
+  vector<SIZE_T> writeptr;      // next page to program, per erase block
+  vector<vector<SIZE_T> > freeblocks; // per die
+  vector<SIZE_T> active;        // erase block being programmed, per die
+  vector<double> diefree;       // time each die, and channel, is free
+  vector<double> channelfree;
+  SIZE_T         nextdie;       // whose turn it is to take a write
+
+  SIZE_T reads, writes, programs, erases;
+
+  void    Setup();
+  SIZE_T  DieOf(const SIZE_T page) const;
+  // How far die is from nextdie, going round
+  SIZE_T  Turn(const SIZE_T die) const;
+  // Maps block to the next page of die's active erase block
+  void    Program(const SIZE_T block, const SIZE_T die);
+  // Makes sure die has a page to program, collecting garbage if
+  // need be and adding the time it takes to gctime
+  // returns false if the die has no room to make
+  bool    MakeRoom(const SIZE_T die, double &gctime);
+
+ protected:
+  double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+  // the time until the die (for a write, any die) is free
+  double PositioningTime(const SIZE_T off, const bool write, const double at) const;
+  // the disk can start another request at once, on another die
+  double Issue(const SIZE_T off, const bool write, const double at, double &finish);
+
+ public:
+  // Opens an existing flash disk
+  FlashDisk(const string &filestem);
+  // Makes a new one; the number of blocks must be a multiple of
+  // pagesperblock
+  FlashDisk(const string &filestem,
+	    const SIZE_T offset,
+	    const SIZE_T blocks,
+	    const SIZE_T blocksize,
+	    const SIZE_T pagesperblock,
+	    const SIZE_T channels,
+	    const SIZE_T diesperchannel,
+	    const double readlat,
+	    const double programlat,
+	    const double eraselat,
+	    const double transferlat,
+	    const double overprovision);
+
+  double GetWriteAmplification() const;
+
+  ostream & Print(ostream &os) const;
+};
+
+#endif
@@ -1,35 +1,66 @@
 #include <string>
+#include <string.h>
 #include <stdlib.h>
 
 #include "disksystem.h"
+#include "flashdisk.h"
 
 
 void usage() 
 {
   cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat\n";
+  cerr << "       makedisk -f filestem blocks blocksize pagesperblock channels diesperchannel readlat programlat eraselat transferlat overprovision\n";
 }
 
 int main(int argc, char *argv[])
 {
-  if (argc<10) { 
-    usage();
-    exit(-1);
-  }
+  DiskSystem *disk;
+
+  if (argc>1 && !strcmp(argv[1],"-f")) { 
+    // a flash disk; the latencies are per page, overprovision in percent
+    if (argc<13) { 
+      usage();
+      exit(-1);
+    }
+    if (atoi(argv[5])<1 || atoi(argv[3])%atoi(argv[5])) { 
+      cerr << "blocks must be a multiple of pagesperblock\n";
+      exit(-1);
+    }
+    disk = new FlashDisk(argv[2],
+			 0,
+			 atoi(argv[3]),
+			 atoi(argv[4]),
+			 atoi(argv[5]),
+			 atoi(argv[6]),
+			 atoi(argv[7]),
+			 atof(argv[8]),
+			 atof(argv[9]),
+			 atof(argv[10]),
+			 atof(argv[11]),
+			 atof(argv[12]));
+  } else {
+    if (argc<10) { 
+      usage();
+      exit(-1);
+    }
 
-  DiskSystem disk(argv[1],
-		  true,
-		  0,
-		  atoi(argv[2]),
-		  atoi(argv[3]),
-		  atoi(argv[4]),
-		  atoi(argv[5]),
-		  atoi(argv[6]),
-		  atof(argv[7]),
-		  atof(argv[8]),
-		  atof(argv[9]));
+    disk = new DiskSystem(argv[1],
+			  true,
+			  0,
+			  atoi(argv[2]),
+			  atoi(argv[3]),
+			  atoi(argv[4]),
+			  atoi(argv[5]),
+			  atoi(argv[6]),
+			  atof(argv[7]),
+			  atof(argv[8]),
+			  atof(argv[9]));
+  }
   
   
-  cerr << "Disk is as follows.\n" << disk << "\n";
+  cerr << "Disk is as follows.\n" << *disk << "\n";
+
+  delete disk;
 
   cerr << "Done.\n";
 
@@ -0,0 +1,144 @@
+#include "missratio.h"
+
+
+// Sampling works on the low bits of a hash of the block number
+#define MRC_HASHBITS 24
+#define MRC_HASHMASK ((1U<<MRC_HASHBITS)-1)
+
+
+MissRatioCurve::MissRatioCurve(const SIZE_T n, const double rate) :
+  numblocks(n),
+  threshold((SIZE_T)(rate*(MRC_HASHMASK+1.0)+0.5)),
+  stamp(n,0),
+  // at most n stamps are live, so renumbering frees at least half
+  owner(2*n+1,0),
+  tree(2*n+1,0),
+  now(0), live(0),
+  hist(n+2,0), readhist(n+2,0),
+  sampled(0), sampledreads(0),
+  references(0), reads(0)
+{
+  if (threshold<1) { 
+    threshold=1;
+  }
+}
+
+bool MissRatioCurve::Sampled(const SIZE_T blocknum) const
+{
+  return ((blocknum*2654435761U)>>(32-MRC_HASHBITS)) < threshold;
+}
+
+double MissRatioCurve::GetRate() const
+{
+  return threshold/(MRC_HASHMASK+1.0);
+}
+
+void MissRatioCurve::Add(SIZE_T pos, const int delta)
+{
+  for (; pos<tree.size(); pos+=pos&(-pos)) { 
+    tree[pos]+=delta;
+  }
+}
+
+// Number of live stamps no later than pos
+SIZE_T MissRatioCurve::Count(SIZE_T pos) const
+{
+  SIZE_T n=0;
+
+  for (; pos>0; pos-=pos&(-pos)) { 
+    n+=tree[pos];
+  }
+  return n;
+}
+
+// Closes up the gaps left by stamps that have been given up
+void MissRatioCurve::Renumber()
+{
+  SIZE_T s, k;
+
+  for (s=1, k=0; s<=now; s++) { 
+    SIZE_T b=owner[s];
+    if (stamp[b]==s) { 
+      k++;
+      stamp[b]=k;
+      owner[k]=b;
+    }
+  }
+  now=k;
+  tree.assign(tree.size(),0);
+  for (s=1; s<=now; s++) { 
+    Add(s,1);
+  }
+}
+
+void MissRatioCurve::Access(const SIZE_T blocknum, const bool read)
+{
+  SIZE_T bucket=numblocks+1;
+
+  references++;
+  if (read) { 
+    reads++;
+  }
+  if (blocknum>=numblocks || !Sampled(blocknum)) { 
+    return;
+  }
+
+  if (stamp[blocknum]) { 
+    // tracked blocks touched since our last access
+    SIZE_T d=live-Count(stamp[blocknum]);
+    double c=d/GetRate()+1;
+    if (c<=numblocks) { 
+      bucket=(SIZE_T)c;
+    }
+    Add(stamp[blocknum],-1);
+    stamp[blocknum]=0;
+    live--;
+  }
+
+  sampled++;
+  hist[bucket]++;
+  if (read) { 
+    sampledreads++;
+    readhist[bucket]++;
+  }
+
+  if (now==owner.size()-1) { 
+    Renumber();
+  }
+  now++;
+  stamp[blocknum]=now;
+  owner[now]=blocknum;
+  Add(now,1);
+  live++;
+}
+
+void MissRatioCurve::Forget()
+{
+  stamp.assign(stamp.size(),0);
+  tree.assign(tree.size(),0);
+  now=0;
+  live=0;
+}
+
+double MissRatioCurve::Ratio(const vector<double> &h, const double n, const SIZE_T cachesize) const
+{
+  double hits=0;
+
+  if (n==0) { 
+    return 0;
+  }
+  for (SIZE_T c=1; c<=cachesize && c<=numblocks; c++) { 
+    hits+=h[c];
+  }
+  return hits/n;
+}
+
+double MissRatioCurve::HitRatio(const SIZE_T cachesize) const
+{
+  return Ratio(hist,sampled,cachesize);
+}
+
+double MissRatioCurve::ReadHitRatio(const SIZE_T cachesize) const
+{
+  return Ratio(readhist,sampledreads,cachesize);
+}
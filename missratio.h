@@ -0,0 +1,66 @@
+#ifndef _missratio
+#define _missratio
+
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Online miss ratio curve estimator
+//
+// Tracks LRU reuse distances for a spatially hashed sample of the
+// blocks (SHARDS, Waldspurger et al.).  A block is tracked if a hash
+// of its number falls under the sampling rate.  The distance
+// measured among tracked blocks, divided by the rate, estimates the
+// distance among all of them.  A reference hits in an LRU cache of c
+// blocks exactly when it is at most c, so one pass gives the hit
+// ratio for every cache size at once.
+//
+// Distances are counted with a Fenwick tree over access stamps,
+// renumbered when the stamps run out, so a reference costs
+// O(log numblocks).  All memory is allocated by the constructor.
+//
+// Not thread safe; callers serialize.
+//
+class MissRatioCurve {
+ private:
+  SIZE_T          numblocks;    // blocks on the device
+  SIZE_T          threshold;    // sample blocks hashing below this
+  vector<SIZE_T>  stamp;        // per block: stamp of its last access, 0 if none
+  vector<SIZE_T>  owner;        // per stamp: the block it was handed to
+  vector<SIZE_T>  tree;         // Fenwick tree marking live stamps
+  SIZE_T          now;          // last stamp handed out
+  SIZE_T          live;         // blocks holding a stamp
+  // references by scaled reuse distance (in blocks), for all
+  // references and for reads only; the last bucket counts first
+  // references and anything farther than the device
+  vector<double>  hist, readhist;
+  double          sampled, sampledreads;
+  SIZE_T          references, reads;
+
+  bool   Sampled(const SIZE_T blocknum) const;
+  void   Add(SIZE_T pos, const int delta);
+  SIZE_T Count(SIZE_T pos) const;
+  void   Renumber();
+  double Ratio(const vector<double> &h, const double n, const SIZE_T cachesize) const;
+ public:
+  // rate is the fraction of blocks to track, 0<rate<=1
+  MissRatioCurve(const SIZE_T numblocks, const double rate);
+
+  // Records a demand reference
+  void   Access(const SIZE_T blocknum, const bool read);
+  // Forgets recency (the cache was emptied) but keeps the counts
+  void   Forget();
+
+  double GetRate() const;
+  SIZE_T GetNumReferences() const { return references; }
+  SIZE_T GetNumReads() const { return reads; }
+  // Estimated fraction of all references, or of reads, that would
+  // hit in an LRU cache of cachesize blocks
+  double HitRatio(const SIZE_T cachesize) const;
+  double ReadHitRatio(const SIZE_T cachesize) const;
+};
+
+#endif
@@ -19,10 +19,10 @@ int main(int argc, char *argv[])
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
-  DiskSystem disk(argv[2]);
-  BufferCache cache(&disk,cachesize);
+  ScopedDisk disk(argv[2]);
+  BufferCache cache(disk.get(),cachesize);
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T blocksize = disk->GetBlockSize();
 
   cache.Attach();
 
@@ -34,6 +34,10 @@ int main(int argc, char *argv[])
       cerr << "Error " << rc <<" occured when reading block "<< i << endl;
       return -1;
     }
+    // single step prefetch: fetch the next block while we print this one
+    if (i+1<(blocknum+numblocks)) { 
+      cache.PrefetchBlock(i+1);
+    }
     for (SIZE_T j=0;j<block.length;j++) { 
       cout << block.data[j];
     }
@@ -47,6 +51,8 @@ int main(int argc, char *argv[])
   cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
   cerr << "numreads        = "<<cache.GetNumReads()<<endl;
   cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+  cerr << "numprefetches   = "<<cache.GetNumPrefetches()<<endl;
+  cerr << "numreadaheads   = "<<cache.GetNumReadaheads()<<endl;
   cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
   cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
   cerr << endl;
@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "scheduler.h"
+
+
+static bool scheduled_blocknum_lessthan(const ScheduledIO &a, const ScheduledIO &b)
+{
+  return a.blocknum < b.blocknum;
+}
+
+
+DiskScheduler::DiskScheduler(const double deadline) :
+  deadline(deadline), dispatched(0), expired(0)
+{}
+
+void DiskScheduler::Add(const SIZE_T blocknum, void *tag, const double arrival)
+{
+  ScheduledIO r;
+
+  r.blocknum=blocknum;
+  r.tag=tag;
+  r.arrival=arrival;
+  // after any others for the same block, so they keep their order
+  pending.insert(upper_bound(pending.begin(),pending.end(),r,
+			     scheduled_blocknum_lessthan),r);
+}
+
+SIZE_T DiskScheduler::Pick(const SIZE_T head, const double now) const
+{
+  SIZE_T oldest=0;
+  SIZE_T i;
+
+  for (i=1;i<pending.size();i++) {
+    if (pending[i].arrival < pending[oldest].arrival) {
+      oldest=i;
+    }
+  }
+  if (deadline>0 && now-pending[oldest].arrival > deadline) {
+    return oldest;
+  }
+
+  // C-LOOK: the first at or past the head, else wrap to the lowest
+  for (i=0;i<pending.size();i++) {
+    if (pending[i].blocknum>=head) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+SIZE_T DiskScheduler::Next(vector<ScheduledIO> &out, const SIZE_T max,
+			   const SIZE_T head, const double now)
+{
+  SIZE_T at=head;
+  SIZE_T n;
+
+  for (n=0;n<max && !pending.empty();n++) {
+    SIZE_T i=Pick(at,now);
+
+    if (deadline>0 && now-pending[i].arrival > deadline) {
+      expired++;
+    }
+    out.push_back(pending[i]);
+    at=pending[i].blocknum;
+    pending.erase(pending.begin()+i);
+    dispatched++;
+  }
+  return n;
+}
+
+ostream & DiskScheduler::Print(ostream &os) const
+{
+  os << "DiskScheduler(pending="<<pending.size()
+     << ", deadline="<<deadline
+     << ", dispatched="<<dispatched
+     << ", expired="<<expired
+     << ")";
+  return os;
+}
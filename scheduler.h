@@ -0,0 +1,69 @@
+#ifndef _scheduler
+#define _scheduler
+
+#include <iostream>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+// A block request waiting in a DiskScheduler
+struct ScheduledIO {
+  SIZE_T  blocknum;
+  void   *tag;       // the caller's
+  double  arrival;   // simulated time it was queued
+};
+
+//
+// Elevator for outstanding block requests
+//
+// Requests are held in block order, which is track order on the
+// disk, and handed out C-LOOK fashion: upward from the head's
+// position, then back around to the lowest block.  Servicing them
+// in one direction keeps seeks short and treats both ends of the
+// disk alike.  A request that has waited longer than the deadline
+// (in simulated milliseconds) is served next regardless, and the
+// sweep carries on from there, so a stream of nearby requests can't
+// starve a far one.
+//
+// The head and the time given to Next should come from the
+// simulated clock of whoever set the requests off, not from whenever
+// a thread gets round to it, or the order won't repeat from one run
+// to the next.
+//
+// Not thread safe; callers serialize.
+//
+class DiskScheduler {
+ private:
+  vector<ScheduledIO> pending;   // sorted by blocknum
+  double              deadline;
+  SIZE_T              dispatched, expired;
+
+  // index of the request to serve after the head, or of the oldest
+  // past its deadline
+  SIZE_T Pick(const SIZE_T head, const double now) const;
+ public:
+  // A deadline of 0 means none
+  DiskScheduler(const double deadline=0);
+
+  void   Add(const SIZE_T blocknum, void *tag, const double arrival);
+  // Takes up to max requests, in the order to issue them, for a disk
+  // whose head is at block head at time now
+  // returns the number taken
+  SIZE_T Next(vector<ScheduledIO> &out, const SIZE_T max,
+	      const SIZE_T head, const double now);
+
+  bool   Empty() const { return pending.empty(); }
+  SIZE_T GetNumPending() const { return pending.size(); }
+  SIZE_T GetNumDispatched() const { return dispatched; }
+  // Requests served out of order because their deadline passed
+  SIZE_T GetNumExpired() const { return expired; }
+  void   SetDeadline(const double d) { deadline=d; }
+
+  ostream &Print(ostream &os) const;
+};
+
+inline ostream & operator<<(ostream &os, const DiskScheduler &s) { return s.Print(os); }
+
+#endif
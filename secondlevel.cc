@@ -0,0 +1,99 @@
+#include "secondlevel.h"
+
+
+SecondLevelCache::SecondLevelCache(DiskSystem *fast, const SIZE_T numblocks) :
+  disk(fast),
+  numslots(fast->GetNumBlocks()),
+  slotof(numblocks,-1),
+  blockin(numslots,0),
+  valid(numslots,false),
+  hand(0), numvalid(0),
+  hits(0), writes(0), invalidations(0)
+{}
+
+SecondLevelCache::~SecondLevelCache()
+{
+  delete disk;
+}
+
+bool SecondLevelCache::Contains(const SIZE_T blocknum) const
+{
+  return blocknum<slotof.size() && slotof[blocknum]>=0;
+}
+
+ERROR_T SecondLevelCache::Read(const SIZE_T blocknum, Block &block, double &reqtime)
+{
+  ERROR_T rc;
+
+  reqtime=0;
+  if (!Contains(blocknum)) {
+    return ERROR_NONEXISTENT;
+  }
+  rc=disk->Read(slotof[blocknum],block,reqtime);
+  if (rc!=ERROR_NOERROR) {
+    Invalidate(blocknum);
+    return rc;
+  }
+  hits++;
+  return ERROR_NOERROR;
+}
+
+ERROR_T SecondLevelCache::Write(const SIZE_T blocknum, const Block &block, double &reqtime)
+{
+  ERROR_T rc;
+  SIZE_T  slot=hand;
+
+  reqtime=0;
+  if (numslots==0 || blocknum>=slotof.size() || Contains(blocknum)) {
+    return ERROR_NOERROR;
+  }
+  if (valid[slot]) {
+    slotof[blockin[slot]]=-1;
+    valid[slot]=false;
+    numvalid--;
+  }
+  rc=disk->Write(slot,block,reqtime);
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  hand=(hand+1)%numslots;
+  slotof[blocknum]=slot;
+  blockin[slot]=blocknum;
+  valid[slot]=true;
+  numvalid++;
+  writes++;
+  return ERROR_NOERROR;
+}
+
+void SecondLevelCache::Invalidate(const SIZE_T blocknum)
+{
+  if (!Contains(blocknum)) {
+    return;
+  }
+  valid[slotof[blocknum]]=false;
+  slotof[blocknum]=-1;
+  numvalid--;
+  invalidations++;
+}
+
+void SecondLevelCache::Clear()
+{
+  for (SIZE_T i=0;i<numslots;i++) {
+    if (valid[i]) {
+      slotof[blockin[i]]=-1;
+      valid[i]=false;
+    }
+  }
+  numvalid=0;
+  hand=0;
+}
+
+ostream & SecondLevelCache::Print(ostream &os) const
+{
+  os << "SecondLevelCache(numslots="<<numslots
+     << ", valid="<<numvalid
+     << ", hits="<<hits
+     << ", writes="<<writes
+     << ", invalidations="<<invalidations<<")";
+  return os;
+}
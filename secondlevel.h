@@ -0,0 +1,71 @@
+#ifndef _secondlevel
+#define _secondlevel
+
+#include <iostream>
+#include <vector>
+
+#include "global.h"
+#include "block.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// Second level victim cache on a faster device
+//
+// Holds copies of clean blocks the buffer cache has evicted, on a
+// DiskSystem of its own with much lower seek and rotational latency
+// (an SSD in front of a slow disk, say).  A miss in the buffer cache
+// looks here before going to the primary disk.
+//
+// Slots are filled in order around the device, overwriting the
+// oldest copy, as L2ARC does; writes to the fast device are then
+// sequential.  A copy is dropped as soon as its block is changed in
+// the buffer cache, so what is here always matches the primary disk.
+// The index is a slot number per primary block, allocated by the
+// constructor.
+//
+// Not thread safe; callers serialize.
+//
+class SecondLevelCache {
+ private:
+  DiskSystem    *disk;       // the fast device
+  SIZE_T         numslots;
+  vector<int>    slotof;     // per primary block: its slot, or -1
+  vector<SIZE_T> blockin;    // per slot: the primary block it holds
+  vector<bool>   valid;      // per slot
+  SIZE_T         hand;       // next slot to fill
+  SIZE_T         numvalid;
+  SIZE_T         hits, writes, invalidations;
+ public:
+  // numblocks is the size of the primary disk; the fast device
+  // must have the same block size.  Takes ownership of fast.
+  SecondLevelCache(DiskSystem *fast, const SIZE_T numblocks);
+  ~SecondLevelCache();
+
+  bool    Contains(const SIZE_T blocknum) const;
+  // Reads the copy of blocknum
+  // returns ERROR_NOERROR, ERROR_NONEXISTENT if there is no copy,
+  // or the device's error
+  ERROR_T Read(const SIZE_T blocknum, Block &block, double &reqtime);
+  // Stores a copy of blocknum in the next slot; reqtime is 0 if a
+  // copy was already there
+  ERROR_T Write(const SIZE_T blocknum, const Block &block, double &reqtime);
+  // Drops the copy of blocknum, if any
+  void    Invalidate(const SIZE_T blocknum);
+  void    Clear();
+  // See DiskSystem::SetIOMode
+  ERROR_T SetIOMode(const DiskIOMode mode) { return disk->SetIOMode(mode); }
+
+  SIZE_T  GetNumSlots() const { return numslots; }
+  SIZE_T  GetNumValid() const { return numvalid; }
+  SIZE_T  GetNumHits() const { return hits; }
+  SIZE_T  GetNumWrites() const { return writes; }
+  SIZE_T  GetNumInvalidations() const { return invalidations; }
+
+  ostream &Print(ostream &os) const;
+};
+
+inline ostream & operator<<(ostream &os, const SecondLevelCache &l) { return l.Print(os); }
+
+#endif
@@ -5,13 +5,15 @@
 #include <strstream>
 #include <fstream>
 #include "btree.h"
+#include "cacheoptions.h"
 
 
 using namespace std;
 
 void usage()
 {
-  cerr << "usage: sim filestem cachesize < specfile \n";
+  cerr << "usage: sim [-p policy] [-s shards] [-d high,low] [-g gap] [-m pct] [-r max] [-t frames] [-a] [-w] [-l fast] [-i mode] [-q depth] filestem cachesize < specfile \n";
+  CacheOptionsUsage(cerr);
 }
 
 
@@ -19,14 +21,18 @@ int main(int argc, char *argv[])
 {
 
   // CONFORMS to the interface of ref_impl.pl
+  // (plus the cache options, which come first)
 
-  if (argc != 3){
+  CacheOptions opts;
+  int arg;
+
+  if ((arg=ParseCacheOptions(argc,argv,opts))<0 || argc-arg!=2) {
     usage();
     return 1;
   }
 
-  char *filestem=argv[1];
-  SIZE_T cachesize=atoi(argv[2]);
+  char *filestem=argv[arg];
+  SIZE_T cachesize=atoi(argv[arg+1]);
   SIZE_T superblocknum;
 
   FILE *file; 
@@ -37,12 +43,17 @@ int main(int argc, char *argv[])
   // We'll connect to the btree only once and then
   // run lots of operations
   // so we need to do this outside the loop
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  ScopedDisk disk(filestem);
+  BufferCache cache(disk.get(),cachesize,opts.policy,opts.shards);
   // will be set on init
   BTreeIndex *btree;
 
 
+  if ((rc=ApplyCacheOptions(cache,opts))!=ERROR_NOERROR) { 
+    usage();
+    return 1;
+  }
+
   if ((rc=cache.Attach())!=ERROR_NOERROR) {
     cerr << "Can't attach cache due to error "<<rc<<"\n";
     return -1;
@@ -122,6 +133,35 @@ int main(int argc, char *argv[])
     
   fclose(file);
 
+  cerr << "Performance statistics:\n";
+  
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+  cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+  cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+  cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+  cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "numdiskwritereqs= "<<cache.GetNumDiskWriteRequests()<<endl;
+  cerr << "numflushes      = "<<cache.GetNumFlushes()<<endl;
+  cerr << "numreadaheads   = "<<cache.GetNumReadaheads()<<endl;
+  cerr << "numreadaheadhits= "<<cache.GetNumReadaheadHits()<<endl;
+  cerr << "numadmissions   = "<<cache.GetNumAdmissions()<<endl;
+  cerr << "numrejections   = "<<cache.GetNumRejections()<<endl;
+  cerr << "numl2hits       = "<<cache.GetNumSecondLevelHits()<<endl;
+  cerr << "numl2writes     = "<<cache.GetNumSecondLevelWrites()<<endl;
+  cerr << "diskmodel       = "<<disk->GetModel()<<endl;
+  cerr << "writeamplif     = "<<disk->GetWriteAmplification()<<endl;
+  cerr << endl;
+  
+  cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+  if (opts.mrcrate>0) { 
+    cerr << endl;
+    cerr << "Miss ratio curve (LRU):\n";
+    cache.PrintMissRatioCurve(cerr);
+  }
+
   return 0;
 
 }
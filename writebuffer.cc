@@ -19,10 +19,10 @@ int main(int argc, char *argv[])
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
 
-  DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  ScopedDisk disk(argv[1]);
+  BufferCache cache(disk.get(),cachesize);
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T blocksize = disk->GetBlockSize();
 
   cache.Attach();
 
@@ -19,8 +19,8 @@ int main(int argc, char *argv[])
   SIZE_T numblocks=atoi(argv[3]);
   double reqtime;
 
-  DiskSystem disk(argv[1]);
-  SIZE_T blocksize = disk.GetBlockSize();
+  ScopedDisk disk(argv[1]);
+  SIZE_T blocksize = disk->GetBlockSize();
 
   vector<Block> b;
 
@@ -33,7 +33,7 @@ int main(int argc, char *argv[])
   }
 
 
-  ERROR_T rc= disk.Write(blocknum, numblocks, b, reqtime);
+  ERROR_T rc= disk->Write(blocknum, numblocks, b, reqtime);
 
   if (rc!=ERROR_NOERROR) { 
     cerr << "Error "<< rc << " occured.\n";